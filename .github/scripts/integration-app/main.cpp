@@ -0,0 +1,155 @@
+// Copyright (c) Itay Grudev 2015 - 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Fixture of .github/scripts/integration-tests.js. The primary instance prints
+// the messages it receives. A secondary instance sends each of its arguments
+// that is not an option as a message, unless an option asks for something else.
+
+#include <cstring>
+#include <iostream>
+#include <QtCore/QTimer>
+#include <singleapplication.h>
+
+static bool hasOption( int argc, char *argv[], const char *option )
+{
+    for( int i = 1; i < argc; ++i ){
+        if( std::strcmp( argv[i], option ) == 0 )
+            return true;
+    }
+    return false;
+}
+
+int main(int argc, char *argv[])
+{
+    // New instances of the fork server return here with the arguments of the requester
+    bool forked = false;
+    if( hasOption( argc, argv, "--fork-server" ) )
+        forked = SingleApplication::startZygote( argc, argv );
+
+    const bool standby = hasOption( argc, argv, "--standby" );
+    const bool sequence = hasOption( argc, argv, "--sequence" );
+    const bool setValues = hasOption( argc, argv, "--set" );
+    const bool getValues = hasOption( argc, argv, "--get" );
+
+    SingleApplication::Options options = SingleApplication::Mode::User;
+    if( hasOption( argc, argv, "--take-over" ) )
+        options |= SingleApplication::Mode::TakeOverUnresponsivePrimary;
+    if( hasOption( argc, argv, "--defer" ) )
+        options |= SingleApplication::Mode::DeferUntilReady;
+    if( hasOption( argc, argv, "--spool" ) )
+        options |= SingleApplication::Mode::SpoolUndeliveredMessages;
+    if( sequence )
+        options |= SingleApplication::Mode::SequenceMessages;
+    if( hasOption( argc, argv, "--fork-server" ) )
+        options |= SingleApplication::Mode::ForkServer;
+
+    SingleApplication app( argc, argv, true, options );
+    if( sequence )
+        app.setOrderingWindow( 200 );
+
+    QStringList payloads;
+    for( const QString &argument : app.arguments().mid( 1 ) ){
+        if( ! argument.startsWith( QStringLiteral( "--" ) ) )
+            payloads << argument;
+    }
+
+    QObject::connect(
+        &app,
+        &SingleApplication::receivedMessage,
+        []( quint32 instanceId, const QByteArray &message ){
+            std::cout << "Received message from instance " << instanceId << ": " << message.constData() << std::endl;
+        }
+    );
+
+    // With --set the arguments are key=value pairs, with --get keys
+    if( setValues ){
+        for( const QString &payload : payloads ){
+            const int separator = payload.indexOf( QLatin1Char( '=' ) );
+            if( ! app.setSharedValue( payload.left( separator ), payload.mid( separator + 1 ).toUtf8() ) ){
+                std::cout << "Unable to set the shared value: " << payload.toStdString() << std::endl;
+                return 1;
+            }
+        }
+    }
+    auto printValues = [&app, &payloads](){
+        for( const QString &key : payloads )
+            std::cout << "Shared value " << key.toStdString() << ": " << app.sharedValue( key ).constData() << std::endl;
+    };
+
+    if( app.isPrimary() ){
+        if( getValues ){
+            QObject::connect( &app, &SingleApplication::sharedValuesChanged, printValues );
+            app.setSharedValuesInterval( 100 );
+        }
+
+        // Considered unresponsive half a second after it stops
+        if( hasOption( argc, argv, "--short-heartbeat" ) )
+            app.setHeartbeatTimeout( 500 );
+
+        // Exits cleanly, handing the role and the held back messages over to a standby
+        if( hasOption( argc, argv, "--quit-after" ) ){
+            app.setHandoverData( "handover-state" );
+            QTimer::singleShot( 4000, &app, &QCoreApplication::quit );
+        }
+
+        // About one message every ten seconds, so a flood is answered busy
+        if( hasOption( argc, argv, "--rate-limit" ) )
+            app.setRateLimit( SingleApplication::GlobalMessageLimit, 0.1, 1 );
+
+        std::cout << "Started a new instance" << std::endl;
+        return app.exec();
+    }
+
+    if( forked )
+        std::cout << "Forked instance " << QCoreApplication::applicationPid() << std::endl;
+
+    if( setValues || getValues ){
+        if( getValues )
+            printValues();
+        return 0;
+    }
+
+    if( standby ){
+        QObject::connect(
+            &app,
+            &SingleApplication::primaryRoleAcquired,
+            [&app](){
+                std::cout << "Took over the primary role, handover data: " << app.handoverData().constData() << std::endl;
+            }
+        );
+        app.watchForPrimaryRole();
+        std::cout << "Waiting for the primary role" << std::endl;
+        return app.exec();
+    }
+
+    for( const QString &payload : payloads ){
+        if( ! app.sendMessage( payload.toUtf8(), 1000 ) ){
+            if( app.lastError() == SingleApplication::PrimaryBusyError )
+                std::cout << "Primary instance is busy, retry after " << app.retryAfter() << " ms" << std::endl;
+            std::cout << "Unable to send: " << payload.toStdString() << std::endl;
+            return 1;
+        }
+    }
+    std::cout << "Sent " << payloads.size() << " messages" << std::endl;
+    return 0;
+}
@@ -43,8 +43,7 @@ function collectFiles(rootDir, fileName) {
   return matches;
 }
 
-function findExecutable(exampleName) {
-  const exampleRoot = path.join(workspace, 'examples', exampleName);
+function findExecutable(exampleName, exampleRoot = path.join(workspace, 'examples', exampleName)) {
   const expectedName = isWindows ? `${exampleName}.exe` : exampleName;
   const defaultPath = path.join(exampleRoot, expectedName);
 
@@ -147,6 +146,10 @@ function killProcess(proc, label) {
   log(`Cleaning up ${label}`);
   try {
     proc.child.kill();
+    if (!isWindows) {
+      // A stopped process only acts on the signal once it continues
+      proc.child.kill('SIGCONT');
+    }
   } catch (err) {
     // Best effort cleanup.
   }
@@ -155,12 +158,17 @@ function killProcess(proc, label) {
 async function main() {
   const basicExe = findExecutable('basic');
   const sendingExe = findExecutable('sending_arguments');
+  const fixtureExe = findExecutable('integration-app', path.join(workspace, '.github', 'scripts', 'integration-app'));
+  const sendExe = path.join(workspace, 'singleapplication-send');
 
   log(`Using basic executable: ${basicExe}`);
   log(`Using sending_arguments executable: ${sendingExe}`);
+  log(`Using integration-app executable: ${fixtureExe}`);
 
   let basicPrimary;
   let sendingPrimary;
+  let fixturePrimary;
+  let fixtureStandby;
 
   try {
     log('Verifying basic example rejects a second instance');
@@ -230,10 +238,408 @@ async function main() {
       'forwarded message on sending_arguments primary'
     );
 
+    if (!isWindows) {
+      assert(fs.existsSync(sendExe), `Unable to find singleapplication-send at ${sendExe}`);
+
+      const cliToken = `cli-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+      log(`Forwarding a message with singleapplication-send: ${cliToken}`);
+      const cliSend = await runAndWait(sendExe, ['--path', sendingExe, cliToken], 5000);
+
+      assert(
+        cliSend.exitCode === 0,
+        `singleapplication-send exit code was ${cliSend.exitCode}, expected 0. Output:\n${cliSend.output}`
+      );
+
+      await waitForOutput(
+        sendingPrimary,
+        (out) => out.includes(cliToken),
+        7000,
+        'message forwarded by singleapplication-send'
+      );
+
+      log('Querying the primary instance with singleapplication-send --introspect');
+      const cliIntrospect = await runAndWait(sendExe, ['--path', sendingExe, '--introspect'], 5000);
+
+      assert(
+        cliIntrospect.exitCode === 0,
+        `singleapplication-send --introspect exit code was ${cliIntrospect.exitCode}, expected 0. Output:\n${cliIntrospect.output}`
+      );
+
+      const snapshot = JSON.parse(cliIntrospect.output);
+      assert(
+        snapshot.instancesInfo.primary === true && snapshot.stats.messagesReceived >= 2,
+        `Unexpected introspection snapshot:\n${cliIntrospect.output}`
+      );
+
+      killProcess(sendingPrimary, 'sending_arguments primary process');
+      sendingPrimary = null;
+      await sleep(500);
+
+      log('Verifying singleapplication-send reports a missing primary instance');
+      const cliMissing = await runAndWait(sendExe, ['--path', sendingExe, '--timeout', '200', cliToken], 5000);
+
+      assert(
+        cliMissing.exitCode === 1,
+        `singleapplication-send exit code without a primary was ${cliMissing.exitCode}, expected 1. Output:\n${cliMissing.output}`
+      );
+    }
+
+    log('Verifying a primary instance that exits hands its role and held back messages to a standby');
+    fixturePrimary = spawnManaged(fixtureExe, ['--defer', '--quit-after']);
+
+    await waitForOutput(
+      fixturePrimary,
+      (out) => out.includes('Started a new instance'),
+      5000,
+      'integration-app exiting primary instance startup'
+    );
+
+    fixtureStandby = spawnManaged(fixtureExe, ['--standby']);
+
+    await waitForOutput(
+      fixtureStandby,
+      (out) => out.includes('Waiting for the primary role'),
+      5000,
+      'integration-app standby instance startup'
+    );
+
+    // The primary instance is not ready, so it acknowledges the message but holds it back
+    const handoverToken = `handover-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+    log(`Queueing a message on the exiting primary instance: ${handoverToken}`);
+    const queued = await runAndWait(fixtureExe, [handoverToken], 5000);
+
+    assert(
+      queued.exitCode === 0,
+      `integration-app secondary exit code with a deferring primary was ${queued.exitCode}, expected 0. Output:\n${queued.output}`
+    );
+
+    await waitForOutput(
+      fixtureStandby,
+      (out) => out.includes('handover data: handover-state') && out.includes(handoverToken),
+      10000,
+      'handover and held back message on the standby instance'
+    );
+
+    const exitStart = Date.now();
+    while (!fixturePrimary.isFinished() && Date.now() - exitStart < 5000) {
+      await sleep(50);
+    }
+
+    assert(
+      fixturePrimary.isFinished() && fixturePrimary.getExitCode() === 0,
+      `Exiting primary instance should have exited cleanly, exit code ${fixturePrimary.getExitCode()}. Output:\n${fixturePrimary.getOutput()}`
+    );
+
+    assert(
+      !fixturePrimary.getOutput().includes(handoverToken),
+      `Exiting primary instance delivered the held back message itself. Output:\n${fixturePrimary.getOutput()}`
+    );
+
+    fixturePrimary = null;
+    killProcess(fixtureStandby, 'integration-app standby process');
+    fixtureStandby = null;
+    await sleep(500);
+
+    log('Verifying a standby instance takes over when the primary instance dies');
+    fixturePrimary = spawnManaged(fixtureExe, []);
+
+    await waitForOutput(
+      fixturePrimary,
+      (out) => out.includes('Started a new instance'),
+      5000,
+      'integration-app primary instance startup'
+    );
+
+    fixtureStandby = spawnManaged(fixtureExe, ['--standby']);
+
+    await waitForOutput(
+      fixtureStandby,
+      (out) => out.includes('Waiting for the primary role'),
+      5000,
+      'integration-app standby instance startup'
+    );
+
+    // Let the standby register with the primary instance
+    await sleep(500);
+    killProcess(fixturePrimary, 'integration-app primary process');
+    fixturePrimary = null;
+
+    await waitForOutput(
+      fixtureStandby,
+      (out) => out.includes('Took over the primary role'),
+      7000,
+      'standby instance taking over the primary role'
+    );
+
+    const standbyToken = `standby-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+    log(`Sending to the new primary instance: ${standbyToken}`);
+    const afterTakeover = await runAndWait(fixtureExe, [standbyToken], 5000);
+
+    assert(
+      afterTakeover.exitCode === 0,
+      `integration-app secondary exit code after the takeover was ${afterTakeover.exitCode}, expected 0. Output:\n${afterTakeover.output}`
+    );
+
+    await waitForOutput(
+      fixtureStandby,
+      (out) => out.includes(standbyToken),
+      7000,
+      'message received by the standby instance that took over'
+    );
+
+    killProcess(fixtureStandby, 'integration-app standby process');
+    fixtureStandby = null;
+    await sleep(500);
+
+    if (!isWindows) {
+      log('Verifying an unresponsive primary instance is taken over after the heartbeat timeout');
+      fixturePrimary = spawnManaged(fixtureExe, ['--short-heartbeat']);
+
+      await waitForOutput(
+        fixturePrimary,
+        (out) => out.includes('Started a new instance'),
+        5000,
+        'integration-app heartbeat primary instance startup'
+      );
+
+      // A stopped primary instance keeps its PID but stops updating the heartbeat
+      process.kill(fixturePrimary.child.pid, 'SIGSTOP');
+      await sleep(1000);
+
+      fixtureStandby = spawnManaged(fixtureExe, ['--take-over']);
+
+      await waitForOutput(
+        fixtureStandby,
+        (out) => out.includes('Started a new instance'),
+        5000,
+        'integration-app instance taking over the unresponsive primary instance'
+      );
+
+      fixturePrimary.child.kill('SIGKILL');
+      fixturePrimary = null;
+      killProcess(fixtureStandby, 'integration-app primary process that took over');
+      fixtureStandby = null;
+      await sleep(500);
+    }
+
+    if (!isWindows) {
+      log('Verifying a message the primary instance does not acknowledge is spooled and delivered after a restart');
+      fixturePrimary = spawnManaged(fixtureExe, ['--spool']);
+
+      await waitForOutput(
+        fixturePrimary,
+        (out) => out.includes('Started a new instance'),
+        5000,
+        'integration-app spooling primary instance startup'
+      );
+
+      // A stopped primary instance still accepts connections but never acknowledges
+      process.kill(fixturePrimary.child.pid, 'SIGSTOP');
+
+      const spoolToken = `spool-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+      log(`Sending to the stopped primary instance: ${spoolToken}`);
+      const spooled = await runAndWait(fixtureExe, ['--spool', spoolToken], 5000);
+
+      assert(
+        spooled.exitCode === 0,
+        `integration-app secondary exit code with a stopped primary was ${spooled.exitCode}, expected 0 once spooled. Output:\n${spooled.output}`
+      );
+
+      fixturePrimary.child.kill('SIGKILL');
+      fixturePrimary = null;
+      await sleep(500);
+
+      fixturePrimary = spawnManaged(fixtureExe, ['--spool']);
+
+      await waitForOutput(
+        fixturePrimary,
+        (out) => out.includes(spoolToken),
+        7000,
+        'spooled message delivered by the next primary instance'
+      );
+
+      killProcess(fixturePrimary, 'integration-app spooling primary process');
+      fixturePrimary = null;
+      await sleep(500);
+    }
+
+    log('Verifying messages of each sender are delivered in the order they were sent');
+    fixturePrimary = spawnManaged(fixtureExe, ['--sequence']);
+
+    await waitForOutput(
+      fixturePrimary,
+      (out) => out.includes('Started a new instance'),
+      5000,
+      'integration-app sequencing primary instance startup'
+    );
+
+    const orderToken = `order-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+    const senderCount = 3;
+    const messageCount = 10;
+    const senders = [];
+    for (let sender = 0; sender < senderCount; ++sender) {
+      const messages = [];
+      for (let index = 0; index < messageCount; ++index) {
+        messages.push(`${orderToken}-${sender}-${index}`);
+      }
+      senders.push(runAndWait(fixtureExe, ['--sequence', ...messages], 10000));
+    }
+
+    for (const sent of await Promise.all(senders)) {
+      assert(
+        sent.exitCode === 0,
+        `integration-app sequencing secondary exit code was ${sent.exitCode}, expected 0. Output:\n${sent.output}`
+      );
+    }
+
+    const orderPattern = new RegExp(`${orderToken}-(\\d+)-(\\d+)`, 'g');
+    const ordered = await waitForOutput(
+      fixturePrimary,
+      (out) => (out.match(orderPattern) || []).length === senderCount * messageCount,
+      7000,
+      'sequenced messages on the primary instance'
+    );
+
+    const lastIndex = new Array(senderCount).fill(-1);
+    for (const match of ordered.matchAll(orderPattern)) {
+      const sender = Number(match[1]);
+      const index = Number(match[2]);
+      assert(
+        index === lastIndex[sender] + 1,
+        `Message ${index} of sender ${sender} was delivered after message ${lastIndex[sender]}. Output:\n${ordered}`
+      );
+      lastIndex[sender] = index;
+    }
+
+    killProcess(fixturePrimary, 'integration-app sequencing primary process');
+    fixturePrimary = null;
+    await sleep(500);
+
+    log('Verifying a rate limited primary instance answers a flood busy');
+    fixturePrimary = spawnManaged(fixtureExe, ['--rate-limit']);
+
+    await waitForOutput(
+      fixturePrimary,
+      (out) => out.includes('Started a new instance'),
+      5000,
+      'integration-app rate limited primary instance startup'
+    );
+
+    const floodToken = `flood-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+    const flood = [];
+    for (let index = 0; index < 10; ++index) {
+      flood.push(runAndWait(fixtureExe, [`${floodToken}-${index}`], 10000));
+    }
+    const flooded = await Promise.all(flood);
+
+    assert(
+      flooded.some((sent) => sent.exitCode === 1 && sent.output.includes('Primary instance is busy')),
+      `No secondary instance of the flood was answered busy. Output:\n${flooded.map((sent) => sent.output).join('')}`
+    );
+
+    assert(
+      !fixturePrimary.isFinished(),
+      `Rate limited primary instance terminated unexpectedly with code ${fixturePrimary.getExitCode()}. Output:\n${fixturePrimary.getOutput()}`
+    );
+
+    if (!isWindows) {
+      log('Verifying singleapplication-send reports a busy reply');
+      const cliBusy = await runAndWait(sendExe, ['--path', fixtureExe, floodToken], 5000);
+
+      assert(
+        cliBusy.exitCode === 3,
+        `singleapplication-send exit code for a rate limited primary was ${cliBusy.exitCode}, expected 3. Output:\n${cliBusy.output}`
+      );
+    }
+
+    killProcess(fixturePrimary, 'integration-app rate limited primary process');
+    fixturePrimary = null;
+    await sleep(500);
+
+    if (!isWindows) {
+      log('Verifying singleapplication-send --fork starts an instance forked from the zygote');
+      fixturePrimary = spawnManaged(fixtureExe, ['--fork-server']);
+
+      await waitForOutput(
+        fixturePrimary,
+        (out) => out.includes('Started a new instance'),
+        5000,
+        'integration-app fork server primary instance startup'
+      );
+
+      // Let the zygote start listening
+      await sleep(500);
+
+      const forkToken = `fork-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+      log(`Forking a new instance with singleapplication-send --fork: ${forkToken}`);
+      const cliFork = await runAndWait(sendExe, ['--fork', '--path', fixtureExe, forkToken], 10000);
+
+      assert(
+        cliFork.exitCode === 0,
+        `singleapplication-send --fork exit code was ${cliFork.exitCode}, expected 0. Output:\n${cliFork.output}`
+      );
+
+      // The new instance writes to the standard output of singleapplication-send
+      const reportedPid = cliFork.output.match(/^(\d+)$/m);
+      const forkedPid = cliFork.output.match(/Forked instance (\d+)/);
+      assert(
+        reportedPid && forkedPid && reportedPid[1] === forkedPid[1],
+        `singleapplication-send --fork did not report the process id of the new instance. Output:\n${cliFork.output}`
+      );
+
+      await waitForOutput(
+        fixturePrimary,
+        (out) => out.includes(forkToken),
+        7000,
+        'message sent by the forked instance'
+      );
+
+      killProcess(fixturePrimary, 'integration-app fork server primary process');
+      fixturePrimary = null;
+      await sleep(500);
+    }
+
+    log('Verifying values shared through the memory block');
+    const valueToken = `value-token-${Date.now()}-${Math.floor(Math.random() * 1000000)}`;
+    fixturePrimary = spawnManaged(fixtureExe, ['--get', 'greeting']);
+
+    await waitForOutput(
+      fixturePrimary,
+      (out) => out.includes('Started a new instance'),
+      5000,
+      'integration-app shared values primary instance startup'
+    );
+
+    const valueSet = await runAndWait(fixtureExe, ['--set', `greeting=${valueToken}`], 5000);
+
+    assert(
+      valueSet.exitCode === 0,
+      `integration-app --set exit code was ${valueSet.exitCode}, expected 0. Output:\n${valueSet.output}`
+    );
+
+    const valueGet = await runAndWait(fixtureExe, ['--get', 'greeting'], 5000);
+
+    assert(
+      valueGet.exitCode === 0 && valueGet.output.includes(`Shared value greeting: ${valueToken}`),
+      `integration-app --get did not read the shared value. Output:\n${valueGet.output}`
+    );
+
+    await waitForOutput(
+      fixturePrimary,
+      (out) => out.includes(`Shared value greeting: ${valueToken}`),
+      7000,
+      'shared value change on the primary instance'
+    );
+
+    killProcess(fixturePrimary, 'integration-app shared values primary process');
+    fixturePrimary = null;
+
     log('Node integration checks completed successfully');
   } finally {
     killProcess(basicPrimary, 'basic primary process');
     killProcess(sendingPrimary, 'sending_arguments primary process');
+    killProcess(fixturePrimary, 'integration-app primary process');
+    killProcess(fixtureStandby, 'integration-app standby process');
   }
 }
 
@@ -25,36 +25,12 @@
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QByteArray>
 #include <QtCore/QSharedMemory>
-
-#ifdef Q_OS_UNIX
-#include <signal.h>
-#include <errno.h>
-#endif
-#ifdef Q_OS_WIN
-#include <windows.h>
-#endif
+#include <QtCore/QScopedPointer>
+#include <QtCore/QCoreApplication>
 
 #include "singleapplication.h"
 #include "singleapplication_p.h"
-
-static bool isProcessRunning( qint64 pid )
-{
-    if ( pid <= 0 )
-        return false;
-
-#ifdef Q_OS_UNIX
-    return kill( static_cast<pid_t>( pid ), 0 ) == 0 || errno != ESRCH;
-#endif
-#ifdef Q_OS_WIN
-    HANDLE hProcess = OpenProcess( PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>( pid ) );
-    if ( hProcess == NULL )
-        return false;
-    DWORD exitCode;
-    bool running = GetExitCodeProcess( hProcess, &exitCode ) && exitCode == STILL_ACTIVE;
-    CloseHandle( hProcess );
-    return running;
-#endif
-}
+#include "singleapplication_core.h"
 
 /**
  * @brief Constructor. Checks and fires up LocalServer or closes the program
@@ -79,6 +55,7 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
 
     // Store the current mode of the program
     d->options = options;
+    d->ready = ! ( options & Mode::DeferUntilReady );
 
     // Add any unique user data
     if ( ! userData.isEmpty() )
@@ -88,36 +65,35 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
     // block and QLocalServer
     d->genBlockServerName();
 
+    // Start connecting while the election runs. If a live primary instance
+    // wins it, the connection is ready by the time it is needed.
+    d->beginConnectToPrimary();
+
+    // Every blocking step below finishes by this point in time
+    const Deadline deadline( timeout );
+
+    TraceScope electionTrace( "election" );
+    QElapsedTimer electionTime;
+    electionTime.start();
+
     // To mitigate QSharedMemory issues with large amount of processes
     // attempting to attach at the same time
-    SingleApplicationPrivate::randomSleep();
+    SingleApplicationPrivate::randomSleep( deadline.remaining() );
 
 #ifdef Q_OS_UNIX
     // By explicitly attaching it and then deleting it we make sure that the
     // memory is deleted even after the process has crashed on Unix.
-#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
-    //d->memory = new QSharedMemory( QNativeIpcKey( d->blockServerName ) ); //old implementation
-    // Use legacy (System V) key type as POSIX realtime shm may not work on macOS
-    d->memory = new QSharedMemory( QSharedMemory::legacyNativeKey( d->blockServerName ) );
-#else
-    d->memory = new QSharedMemory( d->blockServerName );
-#endif
+    d->memory = SingleApplicationPrivate::createMemoryBlock( d->blockServerName );
     d->memory->attach();
     delete d->memory;
 #endif
     // Guarantee thread safe behaviour with a shared memory block.
-#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
-    //d->memory = new QSharedMemory( QNativeIpcKey( d->blockServerName ) ); //old implementation
-    // Use legacy (System V) key type as POSIX realtime shm may not work on macOS
-    d->memory = new QSharedMemory( QSharedMemory::legacyNativeKey( d->blockServerName ) );
-#else
-    d->memory = new QSharedMemory( d->blockServerName );
-#endif
+    d->memory = SingleApplicationPrivate::createMemoryBlock( d->blockServerName );
 
     // Create a shared memory block
     if( d->memory->create( sizeof( InstancesInfo ) )){
         // Initialize the shared memory block
-        if( ! d->memory->lock() ){
+        if( ! d->lockMemory() ){
           qCritical() << "SingleApplication: Unable to lock memory block after create.";
           abortSafely();
         }
@@ -129,7 +105,13 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
               qCritical() << "SingleApplication: Unable to attach to shared memory block.";
               abortSafely();
           }
-          if( ! d->memory->lock() ){
+          // A block created by an incompatible SingleApplication version is smaller
+          // than InstancesInfo and must not be written to
+          if( d->memory->size() < static_cast<int>( sizeof( InstancesInfo ) ) ){
+              qCritical() << "SingleApplication: Shared memory block has an unexpected size.";
+              abortSafely();
+          }
+          if( ! d->lockMemory() ){
             qCritical() << "SingleApplication: Unable to lock memory block after attach.";
             abortSafely();
           }
@@ -140,18 +122,21 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
     }
 
     auto *inst = static_cast<InstancesInfo*>( d->memory->data() );
-    QElapsedTimer time;
-    time.start();
+
+    // Without a deadline an inconsistent block is given up on after a while,
+    // a dead writer would leave it inconsistent forever
+    const Deadline consistencyDeadline( deadline.remaining() < 0 ? static_cast<int>( SingleApplicationPrivate::InconsistentBlockTimeout ) : deadline.remaining() );
 
     // Make sure the shared memory block is initialised and in consistent state
     while( true ){
       // If the shared memory block's checksum is valid continue
       if( d->blockChecksum() == inst->checksum ) break;
 
-      // If more than 5s have elapsed, assume the primary instance crashed and
-      // assume it's position
-      if( time.elapsed() > 5000 ){
-          qWarning() << "SingleApplication: Shared memory block has been in an inconsistent state from more than 5s. Assuming primary instance failure.";
+      // If the deadline passed, assume the primary instance crashed and
+      // assume it's position. Writers hold the lock, so an inconsistent block
+      // means one of them died mid-write.
+      if( consistencyDeadline.hasExpired() ){
+          qWarning() << "SingleApplication: Shared memory block has been in an inconsistent state until the deadline. Assuming primary instance failure.";
           d->initializeMemoryBlock();
       }
 
@@ -162,8 +147,8 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
         qDebug() << "SingleApplication: Unable to unlock memory for random wait.";
         qDebug() << d->memory->errorString();
       }
-      SingleApplicationPrivate::randomSleep();
-      if( ! d->memory->lock() ){
+      SingleApplicationPrivate::randomSleep( deadline.remaining() );
+      if( ! d->lockMemory() ){
         qCritical() << "SingleApplication: Unable to lock memory after random wait.";
         abortSafely();
       }
@@ -171,11 +156,23 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
 
     // If the recorded primary PID is no longer running (e.g. force-killed),
     // take over as the primary instance
-    if( inst->primary && !isProcessRunning( inst->primaryPid ) ){
+    if( inst->primary && !SingleApplicationPrivate::isProcessRunning( inst->primaryPid ) ){
         qWarning() << "SingleApplication: Primary instance (PID" << inst->primaryPid << ") is no longer running. Taking over.";
         d->initializeMemoryBlock();
     }
 
+    // A primary instance that is alive but no longer services its event loop
+    // keeps a valid PID. Connecting to it would only burn the whole timeout.
+    bool primaryUnresponsive = SingleApplicationPrivate::heartbeatExpired( inst );
+    if( primaryUnresponsive && options & Mode::TakeOverUnresponsivePrimary ){
+        qWarning() << "SingleApplication: Primary instance (PID" << inst->primaryPid << ") is not responding. Taking over.";
+        d->initializeMemoryBlock();
+        primaryUnresponsive = false;
+    }
+
+    d->stats.electionTime.store( electionTime.nsecsElapsed() / 1000, std::memory_order_relaxed );
+    electionTrace.finish();
+
     if( inst->primary == false ){
         d->startPrimary();
         if( ! d->memory->unlock() ){
@@ -185,11 +182,18 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
         return;
     }
 
+    // Only the primary instance serves fork requests, so the zygote can exit
+    SingleApplicationPrivate::stopForkServer();
+
     // Check if another instance can be started
     if( allowSecondary ){
         d->startSecondary();
-        if( d->options & Mode::SecondaryNotification ){
-            d->connectToPrimary( timeout, SingleApplicationPrivate::SecondaryInstance );
+        if( d->options & Mode::SecondaryNotification && ! primaryUnresponsive ){
+            if( ! d->connectToPrimary( Deadline( d->adaptiveTimeout( deadline.remaining() ) ), SingleApplicationPrivate::SecondaryInstance ) )
+                d->lastError = deadline.hasExpired() ? DeadlineExceededError : ConnectionFailedError;
+        } else {
+            // The connection started before the election never sends an init message
+            d->abandonHandshake();
         }
         if( ! d->memory->unlock() ){
           qDebug() << "SingleApplication: Unable to unlock memory after secondary start.";
@@ -203,7 +207,11 @@ SingleApplication::SingleApplication( int &argc, char *argv[], bool allowSeconda
       qDebug() << d->memory->errorString();
     }
 
-    d->connectToPrimary( timeout, SingleApplicationPrivate::NewInstance );
+    if( primaryUnresponsive ){
+        qWarning() << "SingleApplication: Primary instance (PID" << inst->primaryPid << ") is not responding. Not notifying it.";
+    } else if( ! d->connectToPrimary( Deadline( d->adaptiveTimeout( deadline.remaining() ) ), SingleApplicationPrivate::NewInstance ) ){
+        d->lastError = deadline.hasExpired() ? DeadlineExceededError : ConnectionFailedError;
+    }
 
     delete d;
 
@@ -282,22 +290,609 @@ QString SingleApplication::currentUser() const
 /**
  * Sends message to the Primary Instance.
  * @param message The message to send.
- * @param timeout the maximum timeout in milliseconds for blocking functions.
+ * @param timeout Deadline in milliseconds for connecting and the acknowledgements, -1 waits forever.
  * @param sendMode mode of operation
  * @return true if the message was sent successfuly, false otherwise.
  */
 bool SingleApplication::sendMessage( const QByteArray &message, int timeout, SendMode sendMode )
+{
+    return sendMessage( static_cast<quint16>( 0 ), message, timeout, sendMode );
+}
+
+/**
+ * Sends a message on a topic to the Primary Instance.
+ * @param topic The topic the primary instance dispatches on, 0 for untyped messages.
+ * @param payload The message to send.
+ * @param timeout Deadline in milliseconds for connecting and the acknowledgements, -1 waits forever.
+ * @param sendMode mode of operation
+ * @return true if the message was sent successfuly, false otherwise.
+ */
+bool SingleApplication::sendMessage( quint16 topic, const QByteArray &payload, int timeout, SendMode sendMode )
+{
+    Q_D( SingleApplication );
+    return d->sendMessage( topic, 0, payload, timeout, sendMode );
+}
+
+/**
+ * Sends several messages to the Primary Instance in a single frame.
+ * @param messages The messages to send.
+ * @param timeout Deadline in milliseconds for connecting and the acknowledgements, -1 waits forever.
+ * @param sendMode mode of operation
+ * @return true if the messages were sent successfuly, false otherwise.
+ */
+bool SingleApplication::sendMessages( const QList<QByteArray> &messages, int timeout, SendMode sendMode )
 {
     Q_D( SingleApplication );
 
-    // Nobody to connect to
-    if( isPrimary() ) return false;
+    if( messages.isEmpty() ) return true;
+
+    // Each item is length prefixed, the primary instance acknowledges once
+    std::string batch;
+    SingleApplicationCore::appendUInt32( batch, static_cast<std::uint32_t>( messages.size() ) );
+    for( const QByteArray &message : messages ){
+        SingleApplicationCore::BatchItem item;
+        item.instanceId = d->instanceNumber;
+        item.payload = message.toStdString();
+        SingleApplicationCore::appendBatchItem( batch, item );
+    }
+
+    return d->sendMessage( 0, SingleApplicationCore::FlagBatch, QByteArray::fromStdString( batch ), timeout, sendMode );
+}
+
+/**
+ * Holds messages back for a window and drops duplicates before emitting them.
+ * @param msecs Length of the window, 0 disables coalescing.
+ * @param keyFunction Key messages are compared by, the message itself if empty.
+ */
+void SingleApplication::setCoalescingWindow( int msecs, CoalescingKeyFunction keyFunction )
+{
+    Q_D( SingleApplication );
+    d->setCoalescingWindow( msecs, keyFunction );
+}
 
-    // Make sure the socket is connected
-    if( ! d->connectToPrimary( timeout,  SingleApplicationPrivate::Reconnect ) )
-      return false;
+/**
+ * Returns the coalescing window.
+ * @return Returns the window in milliseconds, 0 if disabled.
+ */
+int SingleApplication::coalescingWindow() const
+{
+    Q_D( const SingleApplication );
+    return d->coalescingTimer != nullptr ? d->coalescingTimer->interval() : 0;
+}
 
-    return d->writeConfirmedMessage( timeout, message, sendMode );
+/**
+ * Delivers sequenced messages in the order they were sent.
+ * @param msecs Longest wait for a missing message, 0 disables reordering.
+ */
+void SingleApplication::setOrderingWindow( int msecs )
+{
+    Q_D( SingleApplication );
+    d->setOrderingWindow( msecs );
+}
+
+/**
+ * Returns the ordering window.
+ * @return Returns the window in milliseconds, 0 if disabled.
+ */
+int SingleApplication::orderingWindow() const
+{
+    Q_D( const SingleApplication );
+    return d->orderingTimer != nullptr ? d->orderingTimer->interval() : 0;
+}
+
+/**
+ * Limits the work done on connections in one event loop iteration.
+ * @param msecs Time budget, 0 for no limit.
+ * @param bytes Budget of bytes read, 0 for no limit.
+ */
+void SingleApplication::setSchedulingBudget( int msecs, qint64 bytes )
+{
+    Q_D( SingleApplication );
+    d->setSchedulingBudget( msecs, bytes );
+}
+
+/**
+ * Returns the time budget of an event loop iteration.
+ * @return Returns the budget in milliseconds, 0 if unlimited.
+ */
+int SingleApplication::schedulingTimeBudget() const
+{
+    Q_D( const SingleApplication );
+    return d->schedulingTimeBudget;
+}
+
+/**
+ * Returns the byte budget of an event loop iteration.
+ * @return Returns the budget in bytes, 0 if unlimited.
+ */
+qint64 SingleApplication::schedulingByteBudget() const
+{
+    Q_D( const SingleApplication );
+    return d->schedulingByteBudget;
+}
+
+/**
+ * Returns a descriptor that becomes readable when the primary instance has
+ * work to do, for event loops other than Qt's.
+ * @return Returns the descriptor, -1 if unavailable.
+ */
+qintptr SingleApplication::nativeDescriptor()
+{
+    Q_D( SingleApplication );
+    return d->nativeDescriptor();
+}
+
+/**
+ * Runs the primary instance's connection handling without Qt's event loop.
+ * @param msecs Time budget, 0 for no limit.
+ * @return Returns true if work is left.
+ */
+bool SingleApplication::processEvents( int msecs )
+{
+    Q_D( SingleApplication );
+    return d->processEvents( msecs );
+}
+
+/**
+ * Sets whether the primary instance delivers messages. Messages received while
+ * not ready are queued and delivered in order once ready.
+ * @param ready False to hold messages back.
+ */
+void SingleApplication::setReady( bool ready )
+{
+    Q_D( SingleApplication );
+    d->setReady( ready );
+}
+
+/**
+ * Checks whether the primary instance delivers messages.
+ * @return Returns true unless messages are held back.
+ */
+bool SingleApplication::isReady() const
+{
+    Q_D( const SingleApplication );
+    return d->ready;
+}
+
+/**
+ * Environment variables sendActivation() forwards by default.
+ * @return Returns the names of the variables.
+ */
+QStringList SingleApplication::defaultActivationEnvironment()
+{
+    QStringList names;
+    for( const std::string &name : SingleApplicationCore::defaultActivationEnvironment() )
+        names.append( QString::fromStdString( name ) );
+    return names;
+}
+
+/**
+ * Forwards the launch context of the current instance to the Primary Instance.
+ * @param environmentNames Environment variables to forward if set.
+ * @param timeout Deadline in milliseconds for connecting and the acknowledgements, -1 waits forever.
+ * @param sendMode mode of operation
+ * @return true if the activation was sent successfuly, false otherwise.
+ */
+bool SingleApplication::sendActivation( const QStringList &environmentNames, int timeout, SendMode sendMode )
+{
+    Q_D( SingleApplication );
+    const QByteArray payload = SingleApplicationPrivate::activationRecord( environmentNames );
+    return d->sendMessage( 0, SingleApplicationCore::FlagActivation, payload, timeout, sendMode );
+}
+
+namespace {
+
+enum ActivationField {
+    ActivationTimestamp,
+    ActivationWorkingDirectory,
+    ActivationArguments,
+    ActivationEnvironment
+};
+
+/**
+ * @brief Positions the reader at a field of an activation record by skipping
+ * the fields before it without decoding them
+ */
+bool seekActivationField( SingleApplicationCore::Reader &reader, ActivationField field )
+{
+    std::uint8_t version = 0;
+    if( ! reader.readUInt8( version ) || version != SingleApplicationCore::activationRecordVersion() )
+        return false;
+    if( field == ActivationTimestamp ) return true;
+
+    std::uint64_t timestamp = 0;
+    if( ! reader.readUInt64( timestamp ) ) return false;
+    if( field == ActivationWorkingDirectory ) return true;
+
+    const char *begin = nullptr;
+    std::size_t size = 0;
+    if( ! reader.readBytesView( begin, size ) ) return false;
+    if( field == ActivationArguments ) return true;
+
+    std::uint32_t count = 0;
+    if( ! reader.readUInt32( count ) ) return false;
+    for( std::uint32_t i = 0; i < count; ++i ){
+        if( ! reader.readBytesView( begin, size ) ) return false;
+    }
+    return true;
+}
+
+} // namespace
+
+SingleApplication::Activation::Activation( const QByteArray &record )
+    : data( record )
+{
+}
+
+bool SingleApplication::Activation::isValid() const
+{
+    return ! data.isEmpty() && static_cast<quint8>( data.at( 0 ) ) == SingleApplicationCore::activationRecordVersion();
+}
+
+QDateTime SingleApplication::Activation::timestamp() const
+{
+    SingleApplicationCore::Reader reader( data.constData(), static_cast<std::size_t>( data.size() ) );
+    std::uint64_t msecs = 0;
+    if( ! seekActivationField( reader, ActivationTimestamp ) || ! reader.readUInt64( msecs ) )
+        return QDateTime();
+    return QDateTime::fromMSecsSinceEpoch( static_cast<qint64>( msecs ) );
+}
+
+QString SingleApplication::Activation::workingDirectory() const
+{
+    SingleApplicationCore::Reader reader( data.constData(), static_cast<std::size_t>( data.size() ) );
+    const char *begin = nullptr;
+    std::size_t size = 0;
+    if( ! seekActivationField( reader, ActivationWorkingDirectory ) || ! reader.readBytesView( begin, size ) )
+        return QString();
+    return QString::fromUtf8( begin, static_cast<int>( size ) );
+}
+
+QStringList SingleApplication::Activation::arguments() const
+{
+    SingleApplicationCore::Reader reader( data.constData(), static_cast<std::size_t>( data.size() ) );
+    std::uint32_t count = 0;
+    if( ! seekActivationField( reader, ActivationArguments ) || ! reader.readUInt32( count ) )
+        return QStringList();
+
+    QStringList args;
+    const char *begin = nullptr;
+    std::size_t size = 0;
+    for( std::uint32_t i = 0; i < count && reader.readBytesView( begin, size ); ++i )
+        args.append( QString::fromUtf8( begin, static_cast<int>( size ) ) );
+    return args;
+}
+
+QMap<QString, QString> SingleApplication::Activation::environment() const
+{
+    SingleApplicationCore::Reader reader( data.constData(), static_cast<std::size_t>( data.size() ) );
+    std::uint32_t count = 0;
+    if( ! seekActivationField( reader, ActivationEnvironment ) || ! reader.readUInt32( count ) )
+        return QMap<QString, QString>();
+
+    QMap<QString, QString> env;
+    const char *name = nullptr;
+    std::size_t nameSize = 0;
+    const char *value = nullptr;
+    std::size_t valueSize = 0;
+    for( std::uint32_t i = 0; i < count && reader.readBytesView( name, nameSize ) && reader.readBytesView( value, valueSize ); ++i )
+        env.insert( QString::fromUtf8( name, static_cast<int>( nameSize ) ), QString::fromUtf8( value, static_cast<int>( valueSize ) ) );
+    return env;
+}
+
+QByteArray SingleApplication::Activation::record() const
+{
+    return data;
+}
+
+/**
+ * Returns a snapshot of the IPC counters of the current instance.
+ * @return Returns counters and latency histograms.
+ */
+SingleApplication::Stats SingleApplication::stats() const
+{
+    Q_D( const SingleApplication );
+    return d->stats.snapshot();
+}
+
+/**
+ * Sets the interval in which statsUpdated() is emitted.
+ * @param msecs Interval in milliseconds, 0 disables the signal.
+ */
+void SingleApplication::setStatsInterval( int msecs )
+{
+    Q_D( SingleApplication );
+    d->setStatsInterval( msecs );
+}
+
+/**
+ * Returns the interval in which statsUpdated() is emitted.
+ * @return Returns the interval in milliseconds, 0 if disabled.
+ */
+int SingleApplication::statsInterval() const
+{
+    Q_D( const SingleApplication );
+    return d->statsTimer != nullptr && d->statsTimer->isActive() ? d->statsTimer->interval() : 0;
+}
+
+/**
+ * Stores a value in the shared memory block.
+ * @param key Key of at most MaximumSharedKeySize bytes in UTF-8.
+ * @param value Value of at most MaximumSharedValueSize bytes.
+ * @return Returns true if the value was stored.
+ */
+bool SingleApplication::setSharedValue( const QString &key, const QByteArray &value )
+{
+    Q_D( SingleApplication );
+    return d->writeSharedValue( key, &value );
+}
+
+/**
+ * Reads a value from the shared memory block without locking it.
+ * @param key The key of the value.
+ * @param defaultValue Returned if the key is not set.
+ * @return Returns the value.
+ */
+QByteArray SingleApplication::sharedValue( const QString &key, const QByteArray &defaultValue ) const
+{
+    Q_D( const SingleApplication );
+    return d->sharedValue( key, defaultValue );
+}
+
+/**
+ * Removes a value from the shared memory block.
+ * @param key The key of the value.
+ * @return Returns false if the key is too long or the block could not be locked.
+ */
+bool SingleApplication::removeSharedValue( const QString &key )
+{
+    Q_D( SingleApplication );
+    return d->writeSharedValue( key, nullptr );
+}
+
+/**
+ * Sets the interval in which changes of the shared values are checked.
+ * @param msecs Interval in milliseconds, 0 disables sharedValuesChanged().
+ */
+void SingleApplication::setSharedValuesInterval( int msecs )
+{
+    Q_D( SingleApplication );
+    d->setSharedValuesInterval( msecs );
+}
+
+/**
+ * Returns the interval in which changes of the shared values are checked.
+ * @return Returns the interval in milliseconds, 0 if disabled.
+ */
+int SingleApplication::sharedValuesInterval() const
+{
+    Q_D( const SingleApplication );
+    return d->valuesTimer != nullptr && d->valuesTimer->isActive() ? d->valuesTimer->interval() : 0;
+}
+
+/**
+ * Writes trace events of every protocol stage to a file.
+ * @param fileName Chrome/Perfetto JSON trace file, empty to stop writing.
+ * @return Returns true if the file could be opened.
+ */
+bool SingleApplication::setTraceFile( const QString &fileName )
+{
+    return SingleApplicationTrace::setFile( fileName );
+}
+
+/**
+ * Returns an upper bound of a percentile of the distribution.
+ * @param percent Percentile between 0 and 100.
+ * @return Returns the upper bound of the bucket in microseconds.
+ */
+quint64 SingleApplication::Histogram::percentile( double percent ) const
+{
+    if( count == 0 ) return 0;
+
+    const double rank = qBound( 0.0, percent, 100.0 ) / 100.0 * static_cast<double>( count );
+    quint64 seen = 0;
+    for( int i = 0; i < BucketCount - 1; ++i ){
+        seen += buckets[i];
+        if( static_cast<double>( seen ) >= rank )
+            return qMin( static_cast<quint64>( 1 ) << i, max );
+    }
+
+    return max;
+}
+
+/**
+ * Registers the handler of a topic on the primary instance.
+ * @param topic The topic to handle, 0 is reserved for untyped messages.
+ * @param handler Invoked for every message on the topic, empty to unregister.
+ */
+void SingleApplication::registerHandler( quint16 topic, MessageHandler handler )
+{
+    Q_D( SingleApplication );
+
+    if( topic == 0 ){
+        qWarning() << "SingleApplication: Topic 0 is reserved for untyped messages.";
+        return;
+    }
+
+    if( handler ){
+        d->handlers.insert( topic, handler );
+    } else {
+        d->handlers.remove( topic );
+    }
+}
+
+/**
+ * Blocks until the current instance holds the primary role. The instance
+ * takes over as soon as the primary instance exits or dies.
+ * @param timeout Maximum time to wait in milliseconds, -1 to wait forever.
+ * @return Returns true if the instance is the primary instance.
+ */
+bool SingleApplication::waitForPrimaryRole( int timeout )
+{
+    Q_D( SingleApplication );
+    return d->waitForPrimaryRole( timeout );
+}
+
+/**
+ * Makes the current instance take over the primary role as soon as the
+ * primary instance exits or dies, while the event loop keeps running.
+ * primaryRoleAcquired() is emitted once the instance holds the role.
+ */
+void SingleApplication::watchForPrimaryRole()
+{
+    Q_D( SingleApplication );
+    d->startWatchingPrimaryRole();
+}
+
+/**
+ * Sets application state that is handed over to a standby instance together
+ * with undelivered messages when the primary instance exits.
+ * @param data Opaque application state.
+ */
+void SingleApplication::setHandoverData( const QByteArray &data )
+{
+    Q_D( SingleApplication );
+    d->handoverData = data;
+}
+
+/**
+ * Returns the application state handed over by the previous primary instance,
+ * or the state set with setHandoverData().
+ * @return Returns the opaque application state.
+ */
+QByteArray SingleApplication::handoverData() const
+{
+    Q_D( const SingleApplication );
+    return d->handoverData;
+}
+
+/**
+ * Forwards a message to a running primary instance before any Qt application
+ * object exists, so that a redundant launch can exit without initialising a
+ * GUI application.
+ * @param argc Number of arguments in argv
+ * @param argv Supplied command line arguments
+ * @param message The message to send, if empty only instanceStarted() is triggered.
+ * @param options Same flags the SingleApplication constructor receives.
+ * @param timeout The maximum timeout in milliseconds for blocking functions.
+ * @param userData Same user data the SingleApplication constructor receives.
+ * @return true if a primary instance acknowledged the message.
+ */
+bool SingleApplication::forwardToPrimary( int argc, char *argv[], const QByteArray &message, Options options, int timeout, const QString &userData )
+{
+    // A plain QCoreApplication provides the application name and path the key
+    // is derived from, without loading any platform plugin
+    QScopedPointer<QCoreApplication> app;
+    int appArgc = argc;
+    if( QCoreApplication::instance() == nullptr )
+        app.reset( new QCoreApplication( appArgc, argv ) );
+
+    return SingleApplicationPrivate::forwardToPrimary( message, options, timeout, userData );
+}
+
+/**
+ * Starts the zygote that forks new instances in Mode::ForkServer.
+ * @param argc Number of arguments in argv, replaced in a new instance
+ * @param argv Supplied command line arguments, replaced in a new instance
+ * @return true in a new instance the zygote forked.
+ */
+bool SingleApplication::startZygote( int &argc, char **&argv )
+{
+    return SingleApplicationPrivate::startZygote( argc, argv );
+}
+
+/**
+ * Asks a running primary instance to fork a new instance of the application,
+ * which continues with the launch context of the current process.
+ * @param argc Number of arguments in argv
+ * @param argv Supplied command line arguments
+ * @param options Same flags the SingleApplication constructor receives.
+ * @param timeout The maximum timeout in milliseconds for blocking functions.
+ * @param userData Same user data the SingleApplication constructor receives.
+ * @return the process id of the new instance, -1 if none was forked.
+ */
+qint64 SingleApplication::forkFromPrimary( int argc, char *argv[], Options options, int timeout, const QString &userData )
+{
+    QScopedPointer<QCoreApplication> app;
+    int appArgc = argc;
+    if( QCoreApplication::instance() == nullptr )
+        app.reset( new QCoreApplication( appArgc, argv ) );
+
+    return SingleApplicationPrivate::forkFromPrimary( options, timeout, userData );
+}
+
+/**
+ * Returns the reason the last call to sendMessage() failed.
+ * @return Returns the error code, NoError if the last call succeeded.
+ */
+SingleApplication::ConnectionError SingleApplication::lastError() const
+{
+    Q_D( const SingleApplication );
+    return d->lastError;
+}
+
+/**
+ * Returns how long a rate limited primary instance asked to wait.
+ * @return Returns milliseconds, -1 unless the last call failed with
+ * PrimaryBusyError.
+ */
+int SingleApplication::retryAfter() const
+{
+    Q_D( const SingleApplication );
+    return d->lastError == PrimaryBusyError ? d->busyRetryAfter : -1;
+}
+
+/**
+ * Limits the rate of new connections or messages the primary instance accepts.
+ * @param limit What is limited.
+ * @param perSecond Sustained rate, 0 removes the limit.
+ * @param burst Number accepted at once.
+ */
+void SingleApplication::setRateLimit( RateLimit limit, double perSecond, int burst )
+{
+    Q_D( SingleApplication );
+    d->setRateLimit( limit, perSecond, burst );
+}
+
+/**
+ * Sets the heartbeat staleness threshold the primary instance publishes to
+ * launching instances.
+ * @param msecs Threshold in milliseconds, 0 disables the heartbeat.
+ */
+void SingleApplication::setHeartbeatTimeout( int msecs )
+{
+    Q_D( SingleApplication );
+    d->setHeartbeatTimeout( msecs );
+}
+
+/**
+ * Returns the heartbeat staleness threshold.
+ * @return Returns the threshold in milliseconds.
+ */
+int SingleApplication::heartbeatTimeout() const
+{
+    Q_D( const SingleApplication );
+    return d->heartbeatTimeout;
+}
+
+/**
+ * Sets how long messages spooled by this instance remain valid.
+ * @param msecs Time to live in milliseconds.
+ */
+void SingleApplication::setSpoolTimeToLive( int msecs )
+{
+    Q_D( SingleApplication );
+    d->spoolTimeToLive = qMax( msecs, 0 );
+}
+
+/**
+ * Returns how long spooled messages remain valid.
+ * @return Returns the time to live in milliseconds.
+ */
+int SingleApplication::spoolTimeToLive() const
+{
+    Q_D( const SingleApplication );
+    return d->spoolTimeToLive;
 }
 
 /**
@@ -24,7 +24,12 @@
 #ifndef SINGLE_APPLICATION_H
 #define SINGLE_APPLICATION_H
 
+#include <functional>
+
 #include <QtCore/QtGlobal>
+#include <QtCore/QMap>
+#include <QtCore/QDateTime>
+#include <QtCore/QStringList>
 #include <QtNetwork/QLocalSocket>
 
 #ifndef QAPPLICATION_CLASS
@@ -76,7 +81,52 @@ public:
         /**
          * Excludes the application path from the server name (and memory block) hash
          */
-        ExcludeAppPath = 1 << 4
+        ExcludeAppPath = 1 << 4,
+        /**
+         * Take over the primary role when the primary instance is still running but its heartbeat
+         * has gone stale, instead of only skipping the connection attempt
+         * @see setHeartbeatTimeout()
+         */
+        TakeOverUnresponsivePrimary = 1 << 5,
+        /**
+         * Collapse bursts of launches: messages sent by secondary instances within a short window are
+         * staged in shared memory and forwarded by the first of them as a single batch, the others return
+         * as soon as their message is staged
+         * @see sendMessage()
+         */
+        CollapseLaunchStorms = 1 << 6,
+        /**
+         * Start the primary instance in the not ready state: messages are acknowledged but held back
+         * until `setReady()` is called
+         * @see setReady()
+         */
+        DeferUntilReady = 1 << 7,
+        /**
+         * Write messages `sendMessage()` fails to deliver to a journal in the runtime directory. The next
+         * instance to become primary delivers them before any other message.
+         * @see setSpoolTimeToLive()
+         */
+        SpoolUndeliveredMessages = 1 << 8,
+        /**
+         * Stamp messages with a sequence number from a counter in the shared memory block, so the
+         * primary instance can deliver messages from different instances in the order they were sent
+         * @see setOrderingWindow()
+         */
+        SequenceMessages = 1 << 9,
+        /**
+         * Derive the timeouts of connecting and sending from the acknowledgement latencies the primary
+         * instance publishes in the shared memory block. The derived timeout only shortens the given
+         * one, and replaces it if the given one is `-1`.
+         * @note Needs the heartbeat, see `setHeartbeatTimeout()`
+         */
+        AdaptiveTimeouts = 1 << 10,
+        /**
+         * Let launchers ask the primary instance for a new instance, forked from the zygote
+         * `startZygote()` started at the top of `main()`. New instances still initialise Qt, only the
+         * work done before `startZygote()` is saved. Needs secondary instances. Unix only.
+         * @see forkFromPrimary()
+         */
+        ForkServer = 1 << 11
     };
     Q_DECLARE_FLAGS(Options, Mode)
 
@@ -89,15 +139,19 @@ public:
      * if there is already a primary instance.
      * @arg mode - Whether for the `SingleApplication` block to be applied
      * User wide or System wide.
-     * @arg timeout - Timeout to wait in milliseconds.
+     * @arg timeout - Deadline in milliseconds, `-1` waits forever.
      * @note argc and argv may be changed as Qt removes arguments that it
      * recognizes
      * @note `Mode::SecondaryNotification` only works if set on both the primary
      * instance and the secondary instance.
-     * @note The timeout is just a hint for the maximum time of blocking
-     * operations. It does not guarantee that the `SingleApplication`
-     * initialisation will be completed in given time, though is a good hint.
-     * Usually 4*timeout would be the worst case (fail) scenario.
+     * @note If the primary instance is running but has not updated its heartbeat within
+     * its heartbeat timeout it is considered unresponsive and no connection attempt is made.
+     * @note The timeout is a single deadline for every blocking step of the
+     * constructor: the random back-off sleeps, waiting for an inconsistent
+     * memory block to recover and connecting to and notifying the primary
+     * instance. Only waiting for the memory block lock is not bounded. With
+     * `-1` an inconsistent memory block is still reset after five seconds.
+     * If connecting fails, `lastError()` tells whether the deadline passed.
      * @see See the corresponding `QAPPLICATION_CLASS` constructor for reference
      */
     explicit SingleApplication( int &argc, char *argv[], bool allowSecondary = false, Options options = Mode::User, int timeout = 1000, const QString &userData = {} );
@@ -147,16 +201,541 @@ public:
         BlockUntilPrimaryExit,  /** Wait until the primary instance is terminated */
     };
 
+    /**
+     * @brief Reason of the last `sendMessage()` failure.
+     */
+    enum ConnectionError {
+        NoError,  /** The last operation succeeded */
+        ConnectionFailedError,  /** The connection to the primary instance failed or was closed */
+        PrimaryUnresponsiveError,  /** The primary instance heartbeat is stale, no connection was attempted */
+        PrimaryBusyError,  /** The primary instance is rate limited, see retryAfter() */
+        DeadlineExceededError,  /** The timeout passed before the primary instance acknowledged */
+    };
+
+    /**
+     * @brief Limits the primary instance enforces, see `setRateLimit()`
+     */
+    enum RateLimit {
+        GlobalConnectionLimit,  /** New connections from all users together */
+        UserConnectionLimit,  /** New connections from each user */
+        GlobalMessageLimit,  /** Messages from all users together */
+        UserMessageLimit,  /** Messages from each user */
+    };
+
+    /**
+     * @brief Latency distribution with fixed, power of two sized buckets
+     * Bucket `0` counts values below 1 µs, bucket `i` values in
+     * [2^(i-1), 2^i) µs and the last bucket everything above.
+     */
+    struct Histogram {
+        enum : int { BucketCount = 24 };
+        quint64 buckets[BucketCount] = {};
+        quint64 count = 0;
+        quint64 sum = 0; /**< Sum of all values in microseconds */
+        quint64 max = 0; /**< Largest value in microseconds */
+
+        /**
+         * @brief Returns an upper bound of the given percentile
+         * @param percent - percentile between `0` and `100`
+         * @returns upper bound of the bucket the percentile falls into in microseconds
+         */
+        quint64 percentile( double percent ) const;
+    };
+
+    /**
+     * @brief Counters describing the behaviour of the IPC path of the current instance
+     * Times are in microseconds.
+     */
+    struct Stats {
+        qint64 electionTime = 0; /**< Time the constructor needed to decide the role of the instance */
+        qint64 lockWaitTime = 0; /**< Time the constructor waited for the memory block lock */
+        quint64 connectRetries = 0; /**< Failed attempts to connect to the primary instance */
+        quint64 messagesReceived = 0;
+        quint64 bytesReceived = 0;
+        int connectionCount = 0; /**< Open connections on the primary instance */
+        quint64 busyReplies = 0; /**< Connections and messages the primary instance rejected as rate limited */
+        Histogram headerParseTime; /**< Time to read and acknowledge a header frame */
+        Histogram initParseTime; /**< Time to read and validate an initialisation message */
+        Histogram messageParseTime; /**< Time to read and acknowledge a message */
+        Histogram sendToAckLatency; /**< Time from sending a message until the primary instance acknowledged it */
+    };
+
     /**
      * @brief Sends a message to the primary instance
      * @param message data to send
-     * @param timeout timeout for connecting
+     * @param timeout deadline for connecting and the acknowledgements, `-1` waits forever
      * @param sendMode - Mode of operation
      * @returns `true` on success
      * @note sendMessage() will return false if invoked from the primary instance
+     * @note With `Mode::CollapseLaunchStorms` a non-blocking call may return
+     * `true` once the message is staged for another instance to forward. It is
+     * then delivered at most once.
+     * @note With `Mode::SpoolUndeliveredMessages` a call that cannot reach the
+     * primary instance returns `true` once the message is written to the spool.
+     * @see lastError()
      */
     bool sendMessage( const QByteArray &message, int timeout = 100, SendMode sendMode = NonBlocking );
 
+    /**
+     * @brief Sends several messages to the primary instance in a single frame
+     * @param messages - data to send
+     * @param timeout - deadline for connecting and the acknowledgements, `-1` waits forever
+     * @param sendMode - Mode of operation
+     * @returns `true` on success
+     * @note The primary instance emits `receivedMessage()` for each message and
+     * `receivedMessages()` once for all of them. It must run SingleApplication
+     * 3.7 or newer.
+     */
+    bool sendMessages( const QList<QByteArray> &messages, int timeout = 100, SendMode sendMode = NonBlocking );
+
+    /**
+     * @brief Sends a message on a topic to the primary instance
+     * @param topic - topic the primary instance dispatches on, `0` sends an untyped message
+     * @param payload - data to send
+     * @param timeout - deadline for connecting and the acknowledgements, `-1` waits forever
+     * @param sendMode - Mode of operation
+     * @returns `true` on success
+     * @note The topic travels in the frame header, so the primary instance
+     * must run SingleApplication 3.7 or newer. Payloads are limited to 4 GiB.
+     * @see registerHandler()
+     */
+    bool sendMessage( quint16 topic, const QByteArray &payload, int timeout = 100, SendMode sendMode = NonBlocking );
+
+    /**
+     * @brief Message received by the primary instance
+     * @see receivedMessages()
+     */
+    struct Message {
+        quint32 instanceId = 0;
+        QByteArray data;
+    };
+
+    /**
+     * @brief Computes the key messages are deduplicated by
+     * Messages with an empty key are never dropped.
+     */
+    using CoalescingKeyFunction = std::function<QByteArray( const QByteArray &message )>;
+
+    /**
+     * @brief Holds messages back for a window and drops duplicates before
+     * emitting them
+     * @param msecs - length of the window opened by the first message of a
+     * burst, `0` disables coalescing
+     * @param keyFunction - key messages are compared by, the message itself if empty
+     * @note Applies to messages emitted through `receivedMessage()` and
+     * `receivedMessages()`. The first message with a key is kept and later
+     * ones within the window are dropped. Topic handlers and activations are
+     * not delayed.
+     */
+    void setCoalescingWindow( int msecs, CoalescingKeyFunction keyFunction = {} );
+
+    /**
+     * @brief Returns the coalescing window
+     * @returns window in milliseconds, `0` if disabled
+     */
+    int coalescingWindow() const;
+
+    /**
+     * @brief Delivers messages stamped by `Mode::SequenceMessages` in the order
+     * they were sent instead of the order they arrived
+     * @param msecs - longest time a message waits for one with a lower
+     * sequence number, `0` disables reordering
+     * @note A sender that takes a sequence number but fails to deliver its
+     * message holds the messages after it back for the whole window. Messages
+     * arriving after their successors were released are delivered right away.
+     */
+    void setOrderingWindow( int msecs );
+
+    /**
+     * @brief Returns the ordering window
+     * @returns window in milliseconds, `0` if disabled
+     */
+    int orderingWindow() const;
+
+    /**
+     * @brief Limits the work the primary instance does on its connections in
+     * one event loop iteration
+     * @param msecs - time budget, `0` for no limit
+     * @param bytes - budget of bytes read, `0` for no limit
+     * @note Connections with data are served round-robin, one frame at a time,
+     * and the rest is deferred to the next iteration once a budget is used up.
+     * Handshakes, activations and messages up to `BulkMessageSize` bytes go
+     * ahead of larger messages, which are still served at least once per
+     * iteration. With both budgets `0`, the default, connections are read as
+     * soon as data arrives.
+     */
+    void setSchedulingBudget( int msecs, qint64 bytes = 0 );
+
+    /**
+     * @brief Returns the time budget of an event loop iteration
+     * @returns budget in milliseconds, `0` if unlimited
+     */
+    int schedulingTimeBudget() const;
+
+    /**
+     * @brief Returns the byte budget of an event loop iteration
+     * @returns budget in bytes, `0` if unlimited
+     */
+    qint64 schedulingByteBudget() const;
+
+    /**
+     * @brief Size above which a message is served after the latency-sensitive ones
+     */
+    enum : int { BulkMessageSize = 64 * 1024 };
+
+    /**
+     * @brief Returns a descriptor that becomes readable when the primary
+     * instance has connections to accept or data to read
+     * For event loops other than Qt's, such as epoll or asio based ones. Watch
+     * the descriptor for readability and call `processEvents()` when it is.
+     * @returns the descriptor, `-1` on secondary instances and on platforms
+     * other than Linux, where `processEvents()` has to be called periodically
+     * @note The descriptor is owned by `SingleApplication`. Request it again
+     * after `primaryRoleAcquired()`.
+     */
+    qintptr nativeDescriptor();
+
+    /**
+     * @brief Accepts connections, reads and acknowledges frames and fires due
+     * timers of the primary instance without running Qt's event loop
+     * @param msecs - time budget, `0` for no limit
+     * @returns `true` if work is left because the budget ran out
+     * @note Signals are emitted from within the call.
+     */
+    bool processEvents( int msecs = 0 );
+
+    /**
+     * @brief Sets whether the primary instance delivers messages
+     * While not ready, messages are acknowledged and queued in the order they
+     * arrived, `instanceStarted()` is deferred as well. Making the instance
+     * ready delivers the queue before returning.
+     * @param ready - `false` to hold messages back
+     * @note Once `MaximumQueuedMessages` are queued the primary stops reading
+     * from its connections, so further senders wait for their acknowledgement.
+     * @see Mode::DeferUntilReady
+     */
+    void setReady( bool ready = true );
+
+    /**
+     * @brief Checks whether the primary instance delivers messages
+     * @see setReady()
+     */
+    bool isReady() const;
+
+    /**
+     * @brief Number of messages held back while not ready before the primary
+     * stops reading from its connections
+     */
+    enum : int { MaximumQueuedMessages = 1024 };
+
+    /**
+     * @brief Launch context forwarded by `sendActivation()`
+     * A view on the binary record that decodes each field only when it is
+     * accessed, so handlers pay only for what they read.
+     */
+    class Activation {
+    public:
+        Activation() = default;
+        explicit Activation( const QByteArray &record );
+
+        /**
+         * @brief Checks whether the record has a supported version
+         */
+        bool isValid() const;
+
+        /**
+         * @brief Time the secondary instance sent the activation
+         */
+        QDateTime timestamp() const;
+
+        /**
+         * @brief Working directory of the secondary instance
+         */
+        QString workingDirectory() const;
+
+        /**
+         * @brief Command line arguments of the secondary instance
+         */
+        QStringList arguments() const;
+
+        /**
+         * @brief Forwarded subset of the environment of the secondary instance
+         */
+        QMap<QString, QString> environment() const;
+
+        /**
+         * @brief The encoded record
+         */
+        QByteArray record() const;
+
+    private:
+        QByteArray data;
+    };
+
+    /**
+     * @brief Environment variables `sendActivation()` forwards by default
+     * @returns `DESKTOP_STARTUP_ID`, `XDG_ACTIVATION_TOKEN`, `DISPLAY` and `WAYLAND_DISPLAY`
+     */
+    static QStringList defaultActivationEnvironment();
+
+    /**
+     * @brief Forwards the launch context of the current instance to the primary instance
+     * @param environmentNames - environment variables to forward if set
+     * @param timeout - deadline for connecting and the acknowledgements, `-1` waits forever
+     * @param sendMode - Mode of operation
+     * @returns `true` on success
+     * @note The arguments, working directory, environment subset and a
+     * timestamp are sent as one binary record and arrive through
+     * `activationReceived()` instead of `receivedMessage()`. The primary
+     * instance must run SingleApplication 3.7 or newer.
+     */
+    bool sendActivation( const QStringList &environmentNames = defaultActivationEnvironment(), int timeout = 100, SendMode sendMode = NonBlocking );
+
+    /**
+     * @brief Handler for messages on a topic
+     */
+    using MessageHandler = std::function<void( quint32 instanceId, const QByteArray &payload )>;
+
+    /**
+     * @brief Registers the handler of a topic on the primary instance
+     * @param topic - topic to handle, `0` is reserved for untyped messages
+     * @param handler - invoked for every message on the topic, an empty handler
+     * removes the registration
+     * @note Messages on topics without a handler are emitted through
+     * `receivedMessage()`, which remains the catch-all.
+     */
+    void registerHandler( quint16 topic, MessageHandler handler );
+
+    /**
+     * @brief Forwards a message to a running primary instance before the
+     * application object is constructed
+     * @arg argc - Number of arguments in argv
+     * @arg argv - Supplied command line arguments
+     * @arg message - data to send, if empty only `instanceStarted()` is triggered
+     * @arg options - the options the `SingleApplication` constructor receives
+     * @arg timeout - timeout for connecting and sending
+     * @arg userData - the user data the `SingleApplication` constructor receives
+     * @returns `true` if a primary instance acknowledged the message
+     * @note Call it at the top of `main()` and exit if it returns `true`. A
+     * redundant launch then never initialises `QAPPLICATION_CLASS`, which for GUI
+     * applications means never loading the platform plugin. If it returns `false`
+     * construct `SingleApplication` as usual.
+     * @note The application name, organization and version used for the key must
+     * be set before the call, exactly as they are set before the constructor.
+     */
+    static bool forwardToPrimary( int argc, char *argv[], const QByteArray &message = {}, Options options = Mode::User, int timeout = 1000, const QString &userData = {} );
+
+    /**
+     * @brief Starts the zygote of `Mode::ForkServer`, a copy of the current
+     * process that forks new instances for fork requests
+     * @arg argc - Number of arguments in argv
+     * @arg argv - Supplied command line arguments
+     * @returns `true` in a new instance the zygote forked
+     * @note Call it at the top of `main()`, before the application object
+     * exists and before any thread is started. Only what happens before the
+     * call is inherited by new instances, they still initialise Qt themselves.
+     * Every call forks, also in launches that only forward a request. A new
+     * instance returns `true` with the arguments, working directory,
+     * `defaultActivationEnvironment()` and standard input, output and error of
+     * the requester and constructs `SingleApplication` as usual, as a
+     * secondary instance. The zygote exits unless the process becomes the
+     * primary instance. Unix only.
+     */
+    static bool startZygote( int &argc, char **&argv );
+
+    /**
+     * @brief Asks a primary instance in `Mode::ForkServer` for a new instance
+     * before the application object is constructed
+     * @arg argc - Number of arguments in argv
+     * @arg argv - Supplied command line arguments
+     * @arg options - the options the `SingleApplication` constructor receives
+     * @arg timeout - timeout for connecting and forking
+     * @arg userData - the user data the `SingleApplication` constructor receives
+     * @returns process id of the new instance, `-1` if none was forked
+     * @note Exit if it returns a process id, otherwise construct
+     * `SingleApplication` as usual. Unix only.
+     * @see startZygote()
+     */
+    static qint64 forkFromPrimary( int argc, char *argv[], Options options = Mode::User, int timeout = 1000, const QString &userData = {} );
+
+    /**
+     * @brief Returns the reason of the last `sendMessage()` failure
+     * @returns error code, `NoError` if the last call succeeded
+     */
+    ConnectionError lastError() const;
+
+    /**
+     * @brief Returns how long a rate limited primary instance asked to wait
+     * @returns milliseconds, `-1` unless `lastError()` is `PrimaryBusyError`
+     */
+    int retryAfter() const;
+
+    /**
+     * @brief Limits the rate of new connections or messages the primary
+     * instance accepts, using a token bucket
+     * @param limit - what is limited, and whether for all users or each user
+     * @param perSecond - sustained rate, `0` removes the limit
+     * @param burst - number of connections or messages accepted at once
+     * @note Over the limit the primary instance replies busy with the time
+     * until the limit allows another one instead of acknowledging, and
+     * `sendMessage()` fails with `PrimaryBusyError`. A connection is closed
+     * after the reply, a busy message leaves the connection unread until that
+     * time has passed. The sending instances must run SingleApplication 3.7 or
+     * newer. Users are told apart on Unix only, elsewhere the limits for each
+     * user apply to all users together.
+     */
+    void setRateLimit( RateLimit limit, double perSecond, int burst );
+
+    /**
+     * @brief Limits of the values shared through the memory block
+     */
+    enum : int {
+        MaximumSharedValues = 32,
+        MaximumSharedKeySize = 32,
+        MaximumSharedValueSize = 224
+    };
+
+    /**
+     * @brief Stores a value in the shared memory block, visible to every
+     * instance without a round trip to the primary instance
+     * @param key - at most `MaximumSharedKeySize` bytes once UTF-8 encoded
+     * @param value - at most `MaximumSharedValueSize` bytes
+     * @returns `false` if the key or value is too long, all
+     * `MaximumSharedValues` slots are taken or the block cannot be locked
+     * @note Writers take the lock of the memory block. Values live as long as
+     * the block, that is as long as any instance runs.
+     */
+    bool setSharedValue( const QString &key, const QByteArray &value );
+
+    /**
+     * @brief Reads a value from the shared memory block
+     * @returns the value, `defaultValue` if the key is not set
+     * @note Reads neither take the lock nor write to the memory block. They
+     * copy the value and retry if a writer changed the values in the
+     * meantime. If writers keep interfering, or one died halfway until the
+     * next write repairs the values, `defaultValue` is returned.
+     */
+    QByteArray sharedValue( const QString &key, const QByteArray &defaultValue = {} ) const;
+
+    /**
+     * @brief Removes a value from the shared memory block
+     * @returns `false` if the key is too long or the block cannot be locked
+     */
+    bool removeSharedValue( const QString &key );
+
+    /**
+     * @brief Sets the interval in which the current instance checks whether
+     * the shared values changed
+     * @param msecs - interval in milliseconds, `0` disables `sharedValuesChanged()`
+     */
+    void setSharedValuesInterval( int msecs );
+
+    /**
+     * @brief Returns the interval in which the shared values are checked
+     * @returns interval in milliseconds, `0` if disabled
+     */
+    int sharedValuesInterval() const;
+
+    /**
+     * @brief Sets how long the primary instance may go without servicing its
+     * event loop before launching instances consider it unresponsive
+     * @param msecs - staleness threshold in milliseconds, `0` disables the heartbeat
+     * @note The primary instance publishes the threshold in the shared memory
+     * block, so only the value set on the primary instance has an effect.
+     * Heartbeats are only updated while the event loop is running.
+     */
+    void setHeartbeatTimeout( int msecs );
+
+    /**
+     * @brief Returns the heartbeat staleness threshold
+     * @returns threshold in milliseconds, `0` if the heartbeat is disabled
+     */
+    int heartbeatTimeout() const;
+
+    /**
+     * @brief Sets how long spooled messages remain valid
+     * @param msecs - time to live of messages spooled by this instance
+     * @note Messages older than that are discarded instead of being delivered.
+     * @see Mode::SpoolUndeliveredMessages
+     */
+    void setSpoolTimeToLive( int msecs );
+
+    /**
+     * @brief Returns how long spooled messages remain valid
+     * @returns time to live in milliseconds
+     */
+    int spoolTimeToLive() const;
+
+    /**
+     * @brief Blocks until the current instance holds the primary role
+     * @param timeout - maximum time to wait in milliseconds, `-1` waits forever
+     * @returns `true` if the instance is the primary instance
+     * @note The instance registers as a standby with the primary instance and
+     * takes over as soon as it exits or dies. It then listens for connections
+     * like any primary instance.
+     */
+    bool waitForPrimaryRole( int timeout = -1 );
+
+    /**
+     * @brief Non-blocking variant of `waitForPrimaryRole()`
+     * The current instance takes over the primary role as soon as the primary
+     * instance exits or dies and emits `primaryRoleAcquired()`.
+     * @note Requires a running event loop.
+     */
+    void watchForPrimaryRole();
+
+    /**
+     * @brief Sets application state to hand over when the primary instance exits
+     * @param data - opaque application state
+     * @note When the primary instance is destroyed while a standby instance is
+     * waiting for the primary role, the role is handed over to the standby
+     * instance directly, together with messages that have not been delivered yet
+     * and this state. Secondary instances reconnect to the new primary instance.
+     * If the standby instance does not accept the role in time, the messages
+     * are spooled, see `Mode::SpoolUndeliveredMessages`.
+     * @see waitForPrimaryRole()
+     */
+    void setHandoverData( const QByteArray &data );
+
+    /**
+     * @brief Returns the application state handed over by the previous primary instance
+     * @returns opaque application state
+     */
+    QByteArray handoverData() const;
+
+    /**
+     * @brief Returns a snapshot of the IPC counters of the current instance
+     * @returns counters and latency histograms
+     * @note Collection is always enabled and uses relaxed atomics only, so the
+     * snapshot may be taken from any thread.
+     */
+    Stats stats() const;
+
+    /**
+     * @brief Sets the interval in which `statsUpdated()` is emitted
+     * @param msecs - interval in milliseconds, `0` disables the signal
+     */
+    void setStatsInterval( int msecs );
+
+    /**
+     * @brief Returns the interval in which `statsUpdated()` is emitted
+     * @returns interval in milliseconds, `0` if disabled
+     */
+    int statsInterval() const;
+
+    /**
+     * @brief Writes trace events of every protocol stage to a file
+     * @param fileName - file in the Chrome/Perfetto JSON trace format, `%p` is
+     * replaced by the process id. Events are appended, so several processes may
+     * share a file. An empty name stops writing.
+     * @returns `true` if the file could be opened
+     * @note Call it before constructing `SingleApplication` to trace the
+     * constructor. The `SINGLEAPPLICATION_TRACE_FILE` environment variable has
+     * the same effect. Events are also logged to the `singleapplication.trace`
+     * logging category if its debug level was enabled before construction.
+     */
+    static bool setTraceFile( const QString &fileName );
+
     /**
      * @brief Get the set user data.
      * @returns user data
@@ -175,6 +754,42 @@ Q_SIGNALS:
      */
     void receivedMessage( quint32 instanceId, QByteArray message );
 
+    /**
+     * @brief Triggered once for every group of messages delivered together: a
+     * single message, a batch sent in one frame or the messages of a
+     * coalescing window
+     * @note Emitted after `receivedMessage()` was emitted for each of them.
+     * Connect to either signal, not both.
+     * @see setCoalescingWindow()
+     */
+    void receivedMessages( const QList<SingleApplication::Message> &messages );
+
+    /**
+     * @brief Triggered when a secondary instance forwarded its launch context
+     * @see sendActivation()
+     */
+    void activationReceived( quint32 instanceId, const SingleApplication::Activation &activation );
+
+    /**
+     * @brief Triggered when a secondary instance has taken over the primary role
+     * @see waitForPrimaryRole()
+     * @see watchForPrimaryRole()
+     */
+    void primaryRoleAcquired();
+
+    /**
+     * @brief Triggered periodically with a snapshot of the IPC counters
+     * @see setStatsInterval()
+     */
+    void statsUpdated( const SingleApplication::Stats &stats );
+
+    /**
+     * @brief Triggered when an instance, including the current one, changed
+     * the shared values since the last check
+     * @see setSharedValuesInterval()
+     */
+    void sharedValuesChanged();
+
 private:
     SingleApplicationPrivate *d_ptr;
     Q_DECLARE_PRIVATE(SingleApplication)
@@ -182,5 +797,8 @@ private:
 };
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(SingleApplication::Options)
+Q_DECLARE_METATYPE(SingleApplication::Stats)
+Q_DECLARE_METATYPE(SingleApplication::Activation)
+Q_DECLARE_METATYPE(SingleApplication::Message)
 
 #endif // SINGLE_APPLICATION_H
@@ -3,9 +3,11 @@ CONFIG += c++11
 
 HEADERS += $$PWD/SingleApplication \
     $$PWD/singleapplication.h \
-    $$PWD/singleapplication_p.h
+    $$PWD/singleapplication_p.h \
+    $$PWD/singleapplication_core.h
 SOURCES += $$PWD/singleapplication.cpp \
-    $$PWD/singleapplication_p.cpp
+    $$PWD/singleapplication_p.cpp \
+    $$PWD/singleapplication_core.cpp
 
 INCLUDEPATH += $$PWD
 
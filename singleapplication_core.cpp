@@ -0,0 +1,1427 @@
+// Copyright (c) Itay Grudev 2015 - 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <cstdlib>
+#include <random>
+#include <thread>
+
+#include "singleapplication_core.h"
+
+#ifdef SINGLEAPPLICATION_CORE_CLIENT
+    #include <errno.h>
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <unistd.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/types.h>
+    #include <sys/uio.h>
+    #include <sys/un.h>
+    #include <sys/wait.h>
+#endif
+
+namespace SingleApplicationCore {
+
+namespace {
+
+inline std::uint32_t rotr( std::uint32_t x, unsigned n )
+{
+    return ( x >> n ) | ( x << ( 32 - n ) );
+}
+
+inline std::uint32_t rotl( std::uint32_t x, unsigned n )
+{
+    return ( x << n ) | ( x >> ( 32 - n ) );
+}
+
+/**
+ * @brief Incremental SHA-256 as used by `QCryptographicHash::Sha256`
+ */
+class Sha256 {
+public:
+    Sha256()
+    {
+        static const std::uint32_t init[8] = {
+            0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+            0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+        };
+        std::memcpy( state, init, sizeof( state ) );
+    }
+
+    void addData( const std::string &data )
+    {
+        for( unsigned char c : data ){
+            block[blockLen++] = c;
+            if( blockLen == 64 ){
+                transform();
+                blockLen = 0;
+            }
+        }
+        totalLen += data.size();
+    }
+
+    std::string result()
+    {
+        const std::uint64_t bitLen = totalLen * 8;
+        block[blockLen++] = 0x80;
+        if( blockLen > 56 ){
+            while( blockLen < 64 ) block[blockLen++] = 0;
+            transform();
+            blockLen = 0;
+        }
+        while( blockLen < 56 ) block[blockLen++] = 0;
+        for( int i = 7; i >= 0; --i )
+            block[blockLen++] = static_cast<unsigned char>( bitLen >> ( i * 8 ) );
+        transform();
+
+        std::string digest;
+        for( std::uint32_t word : state )
+            appendUInt32( digest, word );
+        return digest;
+    }
+
+private:
+    void transform()
+    {
+        static const std::uint32_t k[64] = {
+            0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+            0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+            0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+            0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+            0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+            0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+            0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+            0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+        };
+
+        std::uint32_t w[64];
+        for( int i = 0; i < 16; ++i ){
+            w[i] = static_cast<std::uint32_t>( block[i * 4] ) << 24 |
+                   static_cast<std::uint32_t>( block[i * 4 + 1] ) << 16 |
+                   static_cast<std::uint32_t>( block[i * 4 + 2] ) << 8 |
+                   static_cast<std::uint32_t>( block[i * 4 + 3] );
+        }
+        for( int i = 16; i < 64; ++i ){
+            const std::uint32_t s0 = rotr( w[i - 15], 7 ) ^ rotr( w[i - 15], 18 ) ^ ( w[i - 15] >> 3 );
+            const std::uint32_t s1 = rotr( w[i - 2], 17 ) ^ rotr( w[i - 2], 19 ) ^ ( w[i - 2] >> 10 );
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+        std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        std::uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for( int i = 0; i < 64; ++i ){
+            const std::uint32_t s1 = rotr( e, 6 ) ^ rotr( e, 11 ) ^ rotr( e, 25 );
+            const std::uint32_t ch = ( e & f ) ^ ( ~e & g );
+            const std::uint32_t t1 = h + s1 + ch + k[i] + w[i];
+            const std::uint32_t s0 = rotr( a, 2 ) ^ rotr( a, 13 ) ^ rotr( a, 22 );
+            const std::uint32_t maj = ( a & b ) ^ ( a & c ) ^ ( b & c );
+            const std::uint32_t t2 = s0 + maj;
+            h = g; g = f; f = e; e = d + t1;
+            d = c; c = b; b = a; a = t1 + t2;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+        state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+    }
+
+    std::uint32_t state[8];
+    unsigned char block[64] = {};
+    std::size_t blockLen = 0;
+    std::uint64_t totalLen = 0;
+};
+
+/**
+ * @brief Incremental MD5 as used by `QCryptographicHash::Md5`
+ */
+class Md5 {
+public:
+    Md5()
+    {
+        state[0] = 0x67452301;
+        state[1] = 0xefcdab89;
+        state[2] = 0x98badcfe;
+        state[3] = 0x10325476;
+    }
+
+    void addData( const std::string &data )
+    {
+        for( unsigned char c : data ){
+            block[blockLen++] = c;
+            if( blockLen == 64 ){
+                transform();
+                blockLen = 0;
+            }
+        }
+        totalLen += data.size();
+    }
+
+    std::string result()
+    {
+        const std::uint64_t bitLen = totalLen * 8;
+        block[blockLen++] = 0x80;
+        if( blockLen > 56 ){
+            while( blockLen < 64 ) block[blockLen++] = 0;
+            transform();
+            blockLen = 0;
+        }
+        while( blockLen < 56 ) block[blockLen++] = 0;
+        for( int i = 0; i < 8; ++i )
+            block[blockLen++] = static_cast<unsigned char>( bitLen >> ( i * 8 ) );
+        transform();
+
+        std::string digest;
+        for( std::uint32_t word : state ){
+            for( int i = 0; i < 4; ++i )
+                digest.push_back( static_cast<char>( word >> ( i * 8 ) ) );
+        }
+        return digest;
+    }
+
+private:
+    void transform()
+    {
+        static const std::uint32_t k[64] = {
+            0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+            0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+            0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+            0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+            0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+            0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+            0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+            0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+        };
+        static const unsigned r[64] = {
+            7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+            5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+            4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+            6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
+        };
+
+        std::uint32_t m[16];
+        for( int i = 0; i < 16; ++i ){
+            m[i] = static_cast<std::uint32_t>( block[i * 4] ) |
+                   static_cast<std::uint32_t>( block[i * 4 + 1] ) << 8 |
+                   static_cast<std::uint32_t>( block[i * 4 + 2] ) << 16 |
+                   static_cast<std::uint32_t>( block[i * 4 + 3] ) << 24;
+        }
+
+        std::uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        for( int i = 0; i < 64; ++i ){
+            std::uint32_t f;
+            int g;
+            if( i < 16 ){
+                f = ( b & c ) | ( ~b & d );
+                g = i;
+            } else if( i < 32 ){
+                f = ( d & b ) | ( ~d & c );
+                g = ( 5 * i + 1 ) % 16;
+            } else if( i < 48 ){
+                f = b ^ c ^ d;
+                g = ( 3 * i + 5 ) % 16;
+            } else {
+                f = c ^ ( b | ~d );
+                g = ( 7 * i ) % 16;
+            }
+            const std::uint32_t tmp = d;
+            d = c;
+            c = b;
+            b = b + rotl( a + f + k[i] + m[g], r[i] );
+            a = tmp;
+        }
+
+        state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    }
+
+    std::uint32_t state[4];
+    unsigned char block[64] = {};
+    std::size_t blockLen = 0;
+    std::uint64_t totalLen = 0;
+};
+
+/**
+ * @brief RFC 2045 Base64 with padding, as `QByteArray::toBase64()`
+ */
+std::string toBase64( const std::string &data )
+{
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string out;
+    out.reserve( ( data.size() + 2 ) / 3 * 4 );
+
+    std::size_t i = 0;
+    for( ; i + 2 < data.size(); i += 3 ){
+        const std::uint32_t chunk = static_cast<std::uint32_t>( static_cast<unsigned char>( data[i] ) ) << 16 |
+                                    static_cast<std::uint32_t>( static_cast<unsigned char>( data[i + 1] ) ) << 8 |
+                                    static_cast<std::uint32_t>( static_cast<unsigned char>( data[i + 2] ) );
+        out.push_back( alphabet[( chunk >> 18 ) & 0x3f] );
+        out.push_back( alphabet[( chunk >> 12 ) & 0x3f] );
+        out.push_back( alphabet[( chunk >> 6 ) & 0x3f] );
+        out.push_back( alphabet[chunk & 0x3f] );
+    }
+
+    if( i < data.size() ){
+        std::uint32_t chunk = static_cast<std::uint32_t>( static_cast<unsigned char>( data[i] ) ) << 16;
+        if( i + 1 < data.size() )
+            chunk |= static_cast<std::uint32_t>( static_cast<unsigned char>( data[i + 1] ) ) << 8;
+        out.push_back( alphabet[( chunk >> 18 ) & 0x3f] );
+        out.push_back( alphabet[( chunk >> 12 ) & 0x3f] );
+        out.push_back( i + 1 < data.size() ? alphabet[( chunk >> 6 ) & 0x3f] : '=' );
+        out.push_back( '=' );
+    }
+
+    return out;
+}
+
+template <typename Hash>
+std::string hashKey( const KeyParameters &key )
+{
+    Hash hash;
+    hash.addData( "SingleApplication" );
+    hash.addData( key.applicationName );
+    hash.addData( key.organizationName );
+    hash.addData( key.organizationDomain );
+
+    if( ! key.userData.empty() )
+        hash.addData( key.userData );
+
+    if( key.includeVersion )
+        hash.addData( key.applicationVersion );
+
+    if( key.includePath )
+        hash.addData( key.applicationFilePath );
+
+    // User level block requires a user specific data in the hash
+    if( key.includeUser )
+        hash.addData( key.userName );
+
+    return hash.result();
+}
+
+} // namespace
+
+std::string blockServerName( const KeyParameters &key )
+{
+#ifdef __APPLE__
+    // Maximum key size on macOS is PSHMNAMLEN (31).
+    std::string name = toBase64( hashKey<Md5>( key ) );
+#else
+    std::string name = toBase64( hashKey<Sha256>( key ) );
+#endif
+
+    // Replace the slash in RFC 2045 Base64 [a-zA-Z0-9+/=] to comply with
+    // server naming requirements.
+    for( char &c : name ){
+        if( c == '/' ) c = '_';
+    }
+    return name;
+}
+
+std::uint16_t checksum( const char *data, std::size_t len )
+{
+    static const std::uint16_t table[16] = {
+        0x0000, 0x1081, 0x2102, 0x3183, 0x4204, 0x5285, 0x6306, 0x7387,
+        0x8408, 0x9489, 0xa50a, 0xb58b, 0xc60c, 0xd68d, 0xe70e, 0xf78f
+    };
+
+    std::uint16_t crc = 0xffff;
+    const unsigned char *p = reinterpret_cast<const unsigned char*>( data );
+    while( len-- ){
+        unsigned char c = *p++;
+        crc = static_cast<std::uint16_t>( ( ( crc >> 4 ) & 0x0fff ) ^ table[( crc ^ c ) & 15] );
+        c >>= 4;
+        crc = static_cast<std::uint16_t>( ( ( crc >> 4 ) & 0x0fff ) ^ table[( crc ^ c ) & 15] );
+    }
+    return static_cast<std::uint16_t>( ~crc );
+}
+
+void appendUInt8( std::string &out, std::uint8_t value )
+{
+    out.push_back( static_cast<char>( value ) );
+}
+
+void appendUInt16( std::string &out, std::uint16_t value )
+{
+    out.push_back( static_cast<char>( value >> 8 ) );
+    out.push_back( static_cast<char>( value ) );
+}
+
+void appendUInt32( std::string &out, std::uint32_t value )
+{
+    for( int shift = 24; shift >= 0; shift -= 8 )
+        out.push_back( static_cast<char>( value >> shift ) );
+}
+
+void appendUInt64( std::string &out, std::uint64_t value )
+{
+    for( int shift = 56; shift >= 0; shift -= 8 )
+        out.push_back( static_cast<char>( value >> shift ) );
+}
+
+void appendBytes( std::string &out, const std::string &bytes )
+{
+    appendUInt32( out, static_cast<std::uint32_t>( bytes.size() ) );
+    out.append( bytes );
+}
+
+Reader::Reader( const char *data, std::size_t len )
+    : data( data ), len( len ), pos( 0 ), valid( true )
+{
+}
+
+bool Reader::take( std::size_t count, const char *&begin )
+{
+    if( ! valid || len - pos < count ){
+        valid = false;
+        return false;
+    }
+    begin = data + pos;
+    pos += count;
+    return true;
+}
+
+bool Reader::readUInt8( std::uint8_t &value )
+{
+    const char *p;
+    if( ! take( 1, p ) ) return false;
+    value = static_cast<std::uint8_t>( *p );
+    return true;
+}
+
+bool Reader::readUInt16( std::uint16_t &value )
+{
+    const char *p;
+    if( ! take( 2, p ) ) return false;
+    value = static_cast<std::uint16_t>( static_cast<unsigned char>( p[0] ) << 8 | static_cast<unsigned char>( p[1] ) );
+    return true;
+}
+
+bool Reader::readUInt32( std::uint32_t &value )
+{
+    const char *p;
+    if( ! take( 4, p ) ) return false;
+    value = 0;
+    for( int i = 0; i < 4; ++i )
+        value = value << 8 | static_cast<unsigned char>( p[i] );
+    return true;
+}
+
+bool Reader::readUInt64( std::uint64_t &value )
+{
+    const char *p;
+    if( ! take( 8, p ) ) return false;
+    value = 0;
+    for( int i = 0; i < 8; ++i )
+        value = value << 8 | static_cast<unsigned char>( p[i] );
+    return true;
+}
+
+bool Reader::readBytes( std::string &bytes )
+{
+    std::uint32_t size = 0;
+    if( ! readUInt32( size ) ) return false;
+
+    // QDataStream writes a null QByteArray with a length of 0xffffffff
+    if( size == 0xffffffff ){
+        bytes.clear();
+        return true;
+    }
+
+    const char *p;
+    if( ! take( size, p ) ) return false;
+    bytes.assign( p, size );
+    return true;
+}
+
+bool Reader::readBytesView( const char *&begin, std::size_t &size )
+{
+    std::uint32_t length = 0;
+    if( ! readUInt32( length ) ) return false;
+
+    if( length == 0xffffffff ){
+        begin = data + pos;
+        size = 0;
+        return true;
+    }
+
+    size = length;
+    return take( size, begin );
+}
+
+std::size_t Reader::position() const
+{
+    return pos;
+}
+
+bool Reader::ok() const
+{
+    return valid;
+}
+
+std::string encodeHeader( std::uint64_t length )
+{
+    std::string header;
+    appendUInt64( header, length );
+    return header;
+}
+
+bool decodeHeader( const char *data, std::size_t len, std::uint64_t &length )
+{
+    Reader reader( data, len );
+    return reader.readUInt64( length );
+}
+
+namespace {
+    const std::uint64_t ExtendedHeaderBit = std::uint64_t( 1 ) << 63;
+    const int FlagsShift = 48;
+    const int TopicShift = 32;
+}
+
+std::string encodeFrameHeader( const FrameHeader &header )
+{
+    if( header.topic == 0 && header.flags == 0 )
+        return encodeHeader( header.length );
+
+    if( header.length > maxExtendedLength() )
+        return std::string();
+
+    return encodeHeader( ExtendedHeaderBit |
+                         std::uint64_t( header.flags ) << FlagsShift |
+                         std::uint64_t( header.topic ) << TopicShift |
+                         header.length );
+}
+
+bool decodeFrameHeader( const char *data, std::size_t len, FrameHeader &header )
+{
+    std::uint64_t raw = 0;
+    if( ! decodeHeader( data, len, raw ) )
+        return false;
+
+    if( raw & ExtendedHeaderBit ){
+        header.length = raw & maxExtendedLength();
+        header.topic = static_cast<std::uint16_t>( raw >> TopicShift );
+        header.flags = static_cast<std::uint8_t>( raw >> FlagsShift );
+    } else {
+        header.length = raw;
+        header.topic = 0;
+        header.flags = 0;
+    }
+    return true;
+}
+
+const std::vector<std::string> &defaultActivationEnvironment()
+{
+    static const std::vector<std::string> names = {
+        "DESKTOP_STARTUP_ID",
+        "XDG_ACTIVATION_TOKEN",
+        "DISPLAY",
+        "WAYLAND_DISPLAY"
+    };
+    return names;
+}
+
+std::string encodeActivation( const ActivationRecord &record )
+{
+    std::string out;
+    appendUInt8( out, activationRecordVersion() );
+    appendUInt64( out, static_cast<std::uint64_t>( record.timestamp ) );
+    appendBytes( out, record.workingDirectory );
+
+    appendUInt32( out, static_cast<std::uint32_t>( record.arguments.size() ) );
+    for( const std::string &argument : record.arguments )
+        appendBytes( out, argument );
+
+    appendUInt32( out, static_cast<std::uint32_t>( record.environment.size() ) );
+    for( const std::pair<std::string, std::string> &variable : record.environment ){
+        appendBytes( out, variable.first );
+        appendBytes( out, variable.second );
+    }
+
+    return out;
+}
+
+void appendBatchItem( std::string &out, const BatchItem &item )
+{
+    appendUInt32( out, item.instanceId );
+    appendUInt16( out, item.topic );
+    appendUInt8( out, item.flags );
+    appendBytes( out, item.payload );
+}
+
+std::string encodeBatch( const std::vector<BatchItem> &items )
+{
+    std::string out;
+    appendUInt32( out, static_cast<std::uint32_t>( items.size() ) );
+    for( const BatchItem &item : items )
+        appendBatchItem( out, item );
+    return out;
+}
+
+bool decodeBatch( const char *data, std::size_t len, std::vector<BatchItem> &items )
+{
+    Reader reader( data, len );
+    std::uint32_t count = 0;
+    if( ! reader.readUInt32( count ) )
+        return false;
+
+    items.clear();
+    for( std::uint32_t i = 0; i < count; ++i ){
+        BatchItem item;
+        if( ! reader.readUInt32( item.instanceId ) || ! reader.readUInt16( item.topic ) ||
+            ! reader.readUInt8( item.flags ) || ! reader.readBytes( item.payload ) )
+            return false;
+        items.push_back( std::move( item ) );
+    }
+    return true;
+}
+
+std::string encodeBusyReply( std::uint32_t retryAfter )
+{
+    std::string out( 1, busyMarker() );
+    appendUInt32( out, retryAfter );
+    return out;
+}
+
+bool decodeBusyReply( const char *data, std::size_t len, std::uint32_t &retryAfter )
+{
+    if( len < busyReplySize() || data[0] != busyMarker() )
+        return false;
+
+    Reader reader( data + 1, len - 1 );
+    return reader.readUInt32( retryAfter );
+}
+
+std::string encodeInitMessage( const InitMessage &message )
+{
+    std::string initMsg;
+    appendBytes( initMsg, message.serverName );
+    appendUInt8( initMsg, message.connectionType );
+    appendUInt32( initMsg, message.instanceId );
+    // Standby instances identify themselves so the role can be handed over to them
+    if( message.connectionType == StandbyInstance )
+        appendUInt64( initMsg, static_cast<std::uint64_t>( message.pid ) );
+    appendUInt16( initMsg, checksum( initMsg.data(), initMsg.size() ) );
+    return initMsg;
+}
+
+bool decodeInitMessage( const char *data, std::size_t len, InitMessage &message )
+{
+    Reader reader( data, len );
+
+    std::uint8_t connectionType = InvalidConnection;
+    reader.readBytes( message.serverName );
+    reader.readUInt8( connectionType );
+    reader.readUInt32( message.instanceId );
+    message.connectionType = static_cast<ConnectionType>( connectionType );
+
+    std::uint64_t pid = 0;
+    if( message.connectionType == StandbyInstance )
+        reader.readUInt64( pid );
+    message.pid = static_cast<std::int64_t>( pid );
+
+    std::uint16_t msgChecksum = 0;
+    reader.readUInt16( msgChecksum );
+
+    return reader.ok() && msgChecksum == checksum( data, len - sizeof( std::uint16_t ) );
+}
+
+#ifdef SINGLEAPPLICATION_CORE_CLIENT
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+/**
+ * @brief Milliseconds left until the deadline, -1 for no deadline
+ */
+int remainingMSecs( const Clock::time_point &deadline, bool forever )
+{
+    if( forever ) return -1;
+    const auto left = std::chrono::duration_cast<std::chrono::milliseconds>( deadline - Clock::now() ).count();
+    return left > 0 ? static_cast<int>( left ) : 0;
+}
+
+/**
+ * @brief Same back-off the Qt implementation uses between connection attempts
+ */
+void randomSleep()
+{
+    static std::minstd_rand generator( static_cast<unsigned>( Clock::now().time_since_epoch().count() ^ getpid() ) );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 8 + generator() % 10 ) );
+}
+
+} // namespace
+
+std::string serverSocketPath( const std::string &serverName )
+{
+    if( ! serverName.empty() && serverName[0] == '/' )
+        return serverName;
+
+    // QLocalServer places relative names in QDir::tempPath()
+    const char *tmpDir = std::getenv( "TMPDIR" );
+    std::string path = tmpDir != nullptr && *tmpDir != '\0' ? tmpDir : "/tmp";
+    while( path.size() > 1 && path[path.size() - 1] == '/' )
+        path.erase( path.size() - 1 );
+
+    return path + '/' + serverName;
+}
+
+Client::Client()
+    : fd( -1 ), busyRetryAfter( -1 )
+{
+}
+
+Client::~Client()
+{
+    close();
+}
+
+bool Client::connectToServer( const std::string &serverName, int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    const std::string path = serverSocketPath( serverName );
+    sockaddr_un address;
+    std::memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    if( path.size() >= sizeof( address.sun_path ) )
+        return false;
+    std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+
+    while( true ){
+        close();
+
+        fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+        if( fd < 0 ) return false;
+
+        ::fcntl( fd, F_SETFD, FD_CLOEXEC );
+        ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+#ifdef SO_NOSIGPIPE
+        const int noSigPipe = 1;
+        ::setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof( noSigPipe ) );
+#endif
+
+        if( ::connect( fd, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) ) == 0 )
+            return true;
+
+        if( errno == EINPROGRESS && waitFor( POLLOUT, remainingMSecs( deadline, forever ) ) ){
+            int error = 0;
+            socklen_t errorLen = sizeof( error );
+            if( ::getsockopt( fd, SOL_SOCKET, SO_ERROR, &error, &errorLen ) == 0 && error == 0 )
+                return true;
+        }
+
+        // The server may not be listening yet or its backlog is full
+        if( ! forever && Clock::now() >= deadline ){
+            close();
+            return false;
+        }
+        randomSleep();
+    }
+}
+
+bool Client::writeInitMessage( const InitMessage &message, int msecs )
+{
+    return writeConfirmedMessage( encodeInitMessage( message ), msecs );
+}
+
+bool Client::writeConfirmedMessage( const std::string &message, int msecs, std::uint16_t topic, std::uint8_t flags )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    FrameHeader header;
+    header.length = message.size();
+    header.topic = topic;
+    header.flags = flags;
+    const std::string headerFrame = encodeFrameHeader( header );
+    if( headerFrame.empty() )
+        return false;
+
+    // Frame 1: The header indicates the message length that follows
+    if( ! writeConfirmedFrame( headerFrame, remainingMSecs( deadline, forever ) ) )
+        return false;
+
+    // Frame 2: The message
+    return writeConfirmedFrame( message, remainingMSecs( deadline, forever ) );
+}
+
+bool Client::writeConfirmedFrame( const std::string &frame, int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    if( ! writeAll( frame.data(), frame.size(), msecs ) )
+        return false;
+
+    busyRetryAfter = -1;
+
+    // await ack byte
+    std::string ack;
+    if( ! read( ack, 1, remainingMSecs( deadline, forever ) ) )
+        return false;
+
+    if( ack[0] != busyMarker() )
+        return true;
+
+    std::string rest;
+    std::uint32_t retryAfter = 0;
+    if( read( rest, busyReplySize() - 1, remainingMSecs( deadline, forever ) ) &&
+        decodeBusyReply( ( ack + rest ).data(), busyReplySize(), retryAfter ) )
+    {
+        busyRetryAfter = static_cast<int>( std::min<std::uint32_t>( retryAfter, 0x7fffffff ) );
+    }
+    return false;
+}
+
+int Client::retryAfter() const
+{
+    return busyRetryAfter;
+}
+
+bool Client::readFrame( std::string &frame, int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    std::string header;
+    std::uint64_t length = 0;
+    if( ! read( header, headerSize(), msecs ) || ! decodeHeader( header.data(), header.size(), length ) )
+        return false;
+
+    return read( frame, static_cast<std::size_t>( length ), remainingMSecs( deadline, forever ) );
+}
+
+bool Client::read( std::string &bytes, std::size_t len, int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    bytes.clear();
+    char buffer[4096];
+    while( bytes.size() < len ){
+        if( fd < 0 ) return false;
+
+        const std::size_t chunk = len - bytes.size() < sizeof( buffer ) ? len - bytes.size() : sizeof( buffer );
+        const ssize_t received = ::recv( fd, buffer, chunk, 0 );
+        if( received > 0 ){
+            bytes.append( buffer, static_cast<std::size_t>( received ) );
+            continue;
+        }
+        if( received == 0 ){
+            close();
+            return false;
+        }
+        if( errno == EINTR ) continue;
+        if( errno != EAGAIN && errno != EWOULDBLOCK ){
+            close();
+            return false;
+        }
+        if( ! waitFor( POLLIN, remainingMSecs( deadline, forever ) ) )
+            return false;
+    }
+    return true;
+}
+
+bool Client::waitForDisconnected( int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    char buffer[256];
+    while( fd >= 0 ){
+        const ssize_t received = ::recv( fd, buffer, sizeof( buffer ), 0 );
+        if( received > 0 || ( received < 0 && errno == EINTR ) ) continue;
+        if( received == 0 || ( errno != EAGAIN && errno != EWOULDBLOCK ) ){
+            close();
+            return true;
+        }
+        if( ! waitFor( POLLIN, remainingMSecs( deadline, forever ) ) )
+            return false;
+    }
+    return true;
+}
+
+void Client::close()
+{
+    if( fd >= 0 ){
+        ::close( fd );
+        fd = -1;
+    }
+}
+
+bool Client::isConnected() const
+{
+    return fd >= 0;
+}
+
+int Client::descriptor() const
+{
+    return fd;
+}
+
+bool Client::writeAll( const char *data, std::size_t len, int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+#ifdef MSG_NOSIGNAL
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+
+    while( len > 0 ){
+        if( fd < 0 ) return false;
+
+        const ssize_t written = ::send( fd, data, len, flags );
+        if( written > 0 ){
+            data += written;
+            len -= static_cast<std::size_t>( written );
+            continue;
+        }
+        if( written < 0 && errno == EINTR ) continue;
+        if( written < 0 && errno != EAGAIN && errno != EWOULDBLOCK ){
+            close();
+            return false;
+        }
+        if( ! waitFor( POLLOUT, remainingMSecs( deadline, forever ) ) )
+            return false;
+    }
+    return true;
+}
+
+bool Client::waitFor( short events, int msecs )
+{
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    while( true ){
+        const int ready = ::poll( &pfd, 1, msecs );
+        if( ready > 0 ) return true;
+        if( ready == 0 ) return false;
+        if( errno != EINTR ) return false;
+    }
+}
+
+namespace {
+
+// An activation record is far smaller, anything larger is not a fork request
+constexpr std::uint32_t MaxForkRequestSize = 1 << 20;
+
+#ifdef MSG_NOSIGNAL
+constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+constexpr int SendFlags = 0;
+#endif
+
+bool waitForDescriptor( int fd, short events, int msecs )
+{
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = events;
+    pfd.revents = 0;
+
+    while( true ){
+        const int ready = ::poll( &pfd, 1, msecs );
+        if( ready > 0 ) return true;
+        if( ready == 0 ) return false;
+        if( errno != EINTR ) return false;
+    }
+}
+
+/**
+ * @brief Creates a non-blocking socket and the address of a socket path
+ */
+int openUnixSocket( const std::string &path, sockaddr_un &address )
+{
+    std::memset( &address, 0, sizeof( address ) );
+    address.sun_family = AF_UNIX;
+    if( path.size() >= sizeof( address.sun_path ) )
+        return -1;
+    std::memcpy( address.sun_path, path.c_str(), path.size() + 1 );
+
+    const int fd = ::socket( AF_UNIX, SOCK_STREAM, 0 );
+    if( fd < 0 ) return -1;
+
+    ::fcntl( fd, F_SETFD, FD_CLOEXEC );
+    ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+#ifdef SO_NOSIGPIPE
+    const int noSigPipe = 1;
+    ::setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof( noSigPipe ) );
+#endif
+    return fd;
+}
+
+/**
+ * @brief Receives exactly `len` bytes, keeping up to three descriptors sent
+ * along and closing any others
+ */
+bool receiveAll( int fd, char *data, std::size_t len, int fds[3], std::size_t &fdCount, const Clock::time_point &deadline, bool forever )
+{
+    while( len > 0 ){
+        iovec iov;
+        iov.iov_base = data;
+        iov.iov_len = len;
+
+        union {
+            cmsghdr header;
+            char buffer[CMSG_SPACE( 3 * sizeof( int ) )];
+        } control;
+
+        msghdr msg;
+        std::memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buffer;
+        msg.msg_controllen = sizeof( control.buffer );
+
+#ifdef MSG_CMSG_CLOEXEC
+        const ssize_t received = ::recvmsg( fd, &msg, MSG_CMSG_CLOEXEC );
+#else
+        const ssize_t received = ::recvmsg( fd, &msg, 0 );
+#endif
+        if( received > 0 ){
+            for( cmsghdr *cmsg = CMSG_FIRSTHDR( &msg ); cmsg != nullptr; cmsg = CMSG_NXTHDR( &msg, cmsg ) ){
+                if( cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ) continue;
+                const std::size_t count = ( cmsg->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+                for( std::size_t i = 0; i < count; ++i ){
+                    int passed = -1;
+                    std::memcpy( &passed, CMSG_DATA( cmsg ) + i * sizeof( int ), sizeof( int ) );
+                    ::fcntl( passed, F_SETFD, FD_CLOEXEC );
+                    if( fdCount < 3 )
+                        fds[fdCount++] = passed;
+                    else
+                        ::close( passed );
+                }
+            }
+            data += received;
+            len -= static_cast<std::size_t>( received );
+            continue;
+        }
+        if( received == 0 ) return false;
+        if( errno == EINTR ) continue;
+        if( errno != EAGAIN && errno != EWOULDBLOCK ) return false;
+        if( ! waitForDescriptor( fd, POLLIN, remainingMSecs( deadline, forever ) ) )
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Whether the peer of a connection runs as the current user
+ */
+bool peerIsCurrentUser( int fd )
+{
+#ifdef __linux__
+    ucred credentials;
+    socklen_t credentialsLen = sizeof( credentials );
+    return ::getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &credentials, &credentialsLen ) == 0 &&
+           credentials.uid == ::geteuid();
+#else
+    uid_t uid;
+    gid_t gid;
+    return ::getpeereid( fd, &uid, &gid ) == 0 && uid == ::geteuid();
+#endif
+}
+
+} // namespace
+
+std::string forkServerPath( const std::string &serverName )
+{
+    return serverSocketPath( serverName ) + "-fork";
+}
+
+int listenForkServer( const std::string &serverName )
+{
+    const std::string path = forkServerPath( serverName );
+    sockaddr_un address;
+    const int fd = openUnixSocket( path, address );
+    if( fd < 0 ) return -1;
+
+    // Permissions are set before listening, so nobody connects in between
+    ::unlink( path.c_str() );
+    if( ::bind( fd, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) ) != 0 ||
+        ::chmod( path.c_str(), 0600 ) != 0 ||
+        ::listen( fd, SOMAXCONN ) != 0 )
+    {
+        ::close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+int acceptForkRequest( int listenFd, std::string &activation, int fds[3], int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+    fds[0] = fds[1] = fds[2] = -1;
+
+    const int fd = ::accept( listenFd, nullptr, nullptr );
+    if( fd < 0 ) return -1;
+
+    // The socket is private to the user, but a forked instance runs with the
+    // environment and descriptors of the requester
+    if( ! peerIsCurrentUser( fd ) ){
+        ::close( fd );
+        return -1;
+    }
+
+    ::fcntl( fd, F_SETFD, FD_CLOEXEC );
+    ::fcntl( fd, F_SETFL, ::fcntl( fd, F_GETFL ) | O_NONBLOCK );
+#ifdef SO_NOSIGPIPE
+    const int noSigPipe = 1;
+    ::setsockopt( fd, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof( noSigPipe ) );
+#endif
+
+    std::size_t fdCount = 0;
+    char length[sizeof( std::uint32_t )];
+    std::uint32_t size = 0;
+    bool ok = receiveAll( fd, length, sizeof( length ), fds, fdCount, deadline, forever );
+    if( ok ){
+        Reader reader( length, sizeof( length ) );
+        ok = reader.readUInt32( size ) && size <= MaxForkRequestSize;
+    }
+    if( ok ){
+        activation.assign( size, '\0' );
+        ok = size == 0 || receiveAll( fd, &activation[0], size, fds, fdCount, deadline, forever );
+    }
+    if( ok && fdCount == 3 )
+        return fd;
+
+    for( std::size_t i = 0; i < fdCount; ++i ){
+        ::close( fds[i] );
+        fds[i] = -1;
+    }
+    ::close( fd );
+    return -1;
+}
+
+void replyForkRequest( int connection, std::int64_t pid )
+{
+    std::string reply;
+    appendUInt64( reply, static_cast<std::uint64_t>( pid ) );
+
+    // The reply fits the buffer of a connection that has not been written to
+    ssize_t written = 0;
+    do {
+        written = ::send( connection, reply.data(), reply.size(), SendFlags );
+    } while( written < 0 && errno == EINTR );
+    ::close( connection );
+}
+
+std::int64_t requestFork( const std::string &serverName, const std::string &activation, const int fds[3], int msecs )
+{
+    const bool forever = msecs < 0;
+    const Clock::time_point deadline = Clock::now() + std::chrono::milliseconds( forever ? 0 : msecs );
+
+    sockaddr_un address;
+    const int fd = openUnixSocket( forkServerPath( serverName ), address );
+    if( fd < 0 ) return -1;
+
+    bool ok = ::connect( fd, reinterpret_cast<sockaddr*>( &address ), sizeof( address ) ) == 0;
+    if( ! ok && errno == EINPROGRESS && waitForDescriptor( fd, POLLOUT, remainingMSecs( deadline, forever ) ) ){
+        int error = 0;
+        socklen_t errorLen = sizeof( error );
+        ok = ::getsockopt( fd, SOL_SOCKET, SO_ERROR, &error, &errorLen ) == 0 && error == 0;
+    }
+
+    // Closed descriptors cannot be sent
+    int sent[3];
+    int opened[3] = { -1, -1, -1 };
+    for( int i = 0; i < 3; ++i ){
+        sent[i] = fds[i];
+        if( ::fcntl( fds[i], F_GETFD ) < 0 ){
+            opened[i] = ::open( "/dev/null", O_RDWR );
+            sent[i] = opened[i];
+            ok = ok && opened[i] >= 0;
+        }
+    }
+
+    std::string request;
+    appendUInt32( request, static_cast<std::uint32_t>( activation.size() ) );
+    request += activation;
+    ok = ok && activation.size() <= MaxForkRequestSize;
+
+    // The descriptors travel with the first bytes of the request
+    const char *data = request.data();
+    std::size_t len = request.size();
+    bool attached = false;
+    while( ok && len > 0 ){
+        iovec iov;
+        iov.iov_base = const_cast<char*>( data );
+        iov.iov_len = len;
+
+        union {
+            cmsghdr header;
+            char buffer[CMSG_SPACE( sizeof( sent ) )];
+        } control;
+
+        msghdr msg;
+        std::memset( &msg, 0, sizeof( msg ) );
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        if( ! attached ){
+            std::memset( &control, 0, sizeof( control ) );
+            msg.msg_control = control.buffer;
+            msg.msg_controllen = sizeof( control.buffer );
+            cmsghdr *cmsg = CMSG_FIRSTHDR( &msg );
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN( sizeof( sent ) );
+            std::memcpy( CMSG_DATA( cmsg ), sent, sizeof( sent ) );
+        }
+
+        const ssize_t written = ::sendmsg( fd, &msg, SendFlags );
+        if( written > 0 ){
+            attached = true;
+            data += written;
+            len -= static_cast<std::size_t>( written );
+            continue;
+        }
+        if( written < 0 && errno == EINTR ) continue;
+        ok = written < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK ) &&
+             waitForDescriptor( fd, POLLOUT, remainingMSecs( deadline, forever ) );
+    }
+
+    for( int i = 0; i < 3; ++i ){
+        if( opened[i] >= 0 ) ::close( opened[i] );
+    }
+
+    std::int64_t pid = -1;
+    char reply[sizeof( std::uint64_t )];
+    int replyFds[3] = { -1, -1, -1 };
+    std::size_t replyFdCount = 0;
+    if( ok && receiveAll( fd, reply, sizeof( reply ), replyFds, replyFdCount, deadline, forever ) ){
+        Reader reader( reply, sizeof( reply ) );
+        std::uint64_t value = 0;
+        if( reader.readUInt64( value ) )
+            pid = static_cast<std::int64_t>( value );
+    }
+    for( std::size_t i = 0; i < replyFdCount; ++i )
+        ::close( replyFds[i] );
+
+    ::close( fd );
+    return pid;
+}
+
+namespace {
+
+// Requests are served one at a time, so a requester that stalls only delays
+// the next requests
+constexpr int ForkRequestTimeout = 1000;
+
+/**
+ * @brief Makes the descriptors of a requester the standard input, output and
+ * error. They may occupy 0 to 2 themselves.
+ */
+void adoptStandardStreams( const int fds[3] )
+{
+    int moved[3];
+    for( int i = 0; i < 3; ++i ){
+        moved[i] = ::fcntl( fds[i], F_DUPFD_CLOEXEC, 3 );
+        if( fds[i] > 2 ) ::close( fds[i] );
+    }
+    for( int i = 0; i < 3; ++i ){
+        if( moved[i] < 0 ) continue;
+        ::dup2( moved[i], i );
+        ::close( moved[i] );
+    }
+}
+
+/**
+ * @brief Forks a new instance, twice so that init adopts it instead of it
+ * becoming a zombie of the zygote
+ * @returns process id of the new instance in the zygote, `0` in the new
+ * instance and `-1` on failure
+ */
+std::int64_t forkInstance()
+{
+    int channel[2];
+    if( ::pipe( channel ) != 0 ) return -1;
+
+    const pid_t intermediate = ::fork();
+    if( intermediate == 0 ){
+        ::close( channel[0] );
+        const pid_t instance = ::fork();
+        if( instance == 0 ){
+            ::close( channel[1] );
+            return 0;
+        }
+        const std::int64_t reported = instance;
+        if( instance < 0 || ::write( channel[1], &reported, sizeof( reported ) ) < 0 )
+            ::_exit( EXIT_FAILURE );
+        ::_exit( EXIT_SUCCESS );
+    }
+
+    ::close( channel[1] );
+    std::int64_t pid = -1;
+    if( intermediate > 0 ){
+        while( ::waitpid( intermediate, nullptr, 0 ) < 0 && errno == EINTR ){}
+        std::int64_t reported = -1;
+        if( ::read( channel[0], &reported, sizeof( reported ) ) == static_cast<ssize_t>( sizeof( reported ) ) )
+            pid = reported;
+    }
+    ::close( channel[0] );
+    return pid;
+}
+
+/**
+ * @brief Main loop of the zygote
+ * @returns only in a new instance, the zygote itself exits
+ */
+std::string runZygote( int control )
+{
+    // Leave the process group, so signals meant for the instance that started
+    // the zygote do not reach it. It follows that instance through the
+    // control connection instead.
+    ::setsid();
+
+    // The server name, or end of file if the instance does not serve requests
+    std::string serverName;
+    {
+        const Clock::time_point never;
+        int fds[3];
+        std::size_t fdCount = 0;
+        char length[sizeof( std::uint32_t )];
+        std::uint32_t size = 0;
+        Reader reader( length, sizeof( length ) );
+        if( ! receiveAll( control, length, sizeof( length ), fds, fdCount, never, true ) ||
+            ! reader.readUInt32( size ) || size > MaxForkRequestSize )
+            ::_exit( EXIT_SUCCESS );
+        serverName.assign( size, '\0' );
+        if( size > 0 && ! receiveAll( control, &serverName[0], size, fds, fdCount, never, true ) )
+            ::_exit( EXIT_SUCCESS );
+        for( std::size_t i = 0; i < fdCount; ++i )
+            ::close( fds[i] );
+    }
+
+    const std::string path = forkServerPath( serverName );
+    const int listenFd = listenForkServer( serverName );
+    if( listenFd < 0 ) ::_exit( EXIT_FAILURE );
+    struct stat bound;
+    const bool statBound = ::stat( path.c_str(), &bound ) == 0;
+
+    while( true ){
+        pollfd pfds[2];
+        pfds[0].fd = control;
+        pfds[0].events = POLLIN;
+        pfds[1].fd = listenFd;
+        pfds[1].events = POLLIN;
+        pfds[0].revents = pfds[1].revents = 0;
+        if( ::poll( pfds, 2, -1 ) < 0 ){
+            if( errno == EINTR ) continue;
+            break;
+        }
+
+        // Nothing else is sent, so the instance closed the connection
+        if( pfds[0].revents != 0 ) break;
+        if( ( pfds[1].revents & POLLIN ) == 0 ) continue;
+
+        std::string activation;
+        int fds[3];
+        const int connection = acceptForkRequest( listenFd, activation, fds, ForkRequestTimeout );
+        if( connection < 0 ) continue;
+
+        const std::int64_t pid = forkInstance();
+        if( pid == 0 ){
+            ::close( connection );
+            ::close( listenFd );
+            ::close( control );
+            ::setsid();
+            adoptStandardStreams( fds );
+            return activation;
+        }
+
+        for( int fd : fds )
+            ::close( fd );
+        replyForkRequest( connection, pid );
+    }
+
+    // A new primary instance may have replaced the socket in the meantime
+    struct stat current;
+    if( statBound && ::stat( path.c_str(), &current ) == 0 &&
+        current.st_dev == bound.st_dev && current.st_ino == bound.st_ino )
+        ::unlink( path.c_str() );
+    ::_exit( EXIT_SUCCESS );
+}
+
+} // namespace
+
+ZygoteResult startZygote()
+{
+    ZygoteResult result;
+    int channel[2];
+    if( ::socketpair( AF_UNIX, SOCK_STREAM, 0, channel ) != 0 )
+        return result;
+
+    // Forked twice as well, so the zygote never becomes a zombie of the
+    // instance that started it
+    const std::int64_t zygote = forkInstance();
+    if( zygote == 0 ){
+        ::close( channel[0] );
+        result.activation = runZygote( channel[1] );
+        result.instance = true;
+        return result;
+    }
+
+    ::close( channel[1] );
+    if( zygote < 0 ){
+        ::close( channel[0] );
+        return result;
+    }
+    ::fcntl( channel[0], F_SETFD, FD_CLOEXEC );
+    result.control = channel[0];
+    return result;
+}
+
+bool serveForkRequests( int control, const std::string &serverName )
+{
+    if( control < 0 || serverName.size() > MaxForkRequestSize )
+        return false;
+
+    std::string request;
+    appendUInt32( request, static_cast<std::uint32_t>( serverName.size() ) );
+    request += serverName;
+
+    // Fits the buffer of a connection that has not been written to
+    const char *data = request.data();
+    std::size_t len = request.size();
+    while( len > 0 ){
+        const ssize_t written = ::send( control, data, len, SendFlags );
+        if( written < 0 && errno == EINTR ) continue;
+        if( written <= 0 ) return false;
+        data += written;
+        len -= static_cast<std::size_t>( written );
+    }
+    return true;
+}
+
+#endif // SINGLEAPPLICATION_CORE_CLIENT
+
+} // namespace SingleApplicationCore
@@ -0,0 +1,409 @@
+// Copyright (c) Itay Grudev 2015 - 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef SINGLE_APPLICATION_CORE_H
+#define SINGLE_APPLICATION_CORE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+  #define SINGLEAPPLICATION_CORE_CLIENT 1
+#endif
+
+/**
+ * @brief Dependency-free part of SingleApplication: key derivation, the wire
+ * protocol and (on Unix) a client that talks to a primary instance.
+ *
+ * `SingleApplication` uses it for everything that does not need Qt. It can be
+ * used on its own by launchers that forward messages without loading Qt.
+ * @note The protocol is byte compatible with `QDataStream::Qt_5_6`.
+ */
+namespace SingleApplicationCore {
+
+/**
+ * @brief Type of a connection, sent as part of the initialisation message
+ */
+enum ConnectionType : std::uint8_t {
+    InvalidConnection = 0,
+    NewInstance = 1,
+    SecondaryInstance = 2,
+    Reconnect = 3,
+    StandbyInstance = 4,
+    IntrospectionRequest = 5 // Answered with a snapshot frame, see readFrame()
+};
+
+/**
+ * @brief Everything the server name and memory block key are derived from
+ * @note Strings are UTF-8 encoded. Platform specific normalisation, such as
+ * lower-casing the path on Windows, is up to the caller.
+ */
+struct KeyParameters {
+    std::string applicationName;
+    std::string organizationName;
+    std::string organizationDomain;
+    std::string applicationVersion;
+    std::string applicationFilePath;
+    std::string userData; // All user data joined without a separator
+    std::string userName;
+    bool includeVersion = true;
+    bool includePath = true;
+    bool includeUser = true;
+};
+
+/**
+ * @brief Contents of an initialisation message
+ */
+struct InitMessage {
+    std::string serverName;
+    ConnectionType connectionType = InvalidConnection;
+    std::uint32_t instanceId = 0;
+    std::int64_t pid = 0; // Only sent by standby instances
+};
+
+/**
+ * @brief Derives the name shared by the memory block and the local server
+ * @returns Base64 encoded SHA-256 (MD5 on macOS) hash with `/` replaced by `_`
+ */
+std::string blockServerName( const KeyParameters &key );
+
+/**
+ * @brief CRC-16 checksum compatible with `qChecksum()` (ISO 3309)
+ */
+std::uint16_t checksum( const char *data, std::size_t len );
+
+void appendUInt8( std::string &out, std::uint8_t value );
+void appendUInt16( std::string &out, std::uint16_t value );
+void appendUInt32( std::string &out, std::uint32_t value );
+void appendUInt64( std::string &out, std::uint64_t value );
+void appendBytes( std::string &out, const std::string &bytes );
+
+/**
+ * @brief Sequential big endian reader matching `QDataStream`
+ */
+class Reader {
+public:
+    Reader( const char *data, std::size_t len );
+
+    bool readUInt8( std::uint8_t &value );
+    bool readUInt16( std::uint16_t &value );
+    bool readUInt32( std::uint32_t &value );
+    bool readUInt64( std::uint64_t &value );
+    bool readBytes( std::string &bytes );
+
+    /**
+     * @brief Reads a byte array without copying it
+     * @param begin - set to the first byte of the array inside the data
+     */
+    bool readBytesView( const char *&begin, std::size_t &size );
+
+    std::size_t position() const;
+    bool ok() const;
+
+private:
+    bool take( std::size_t len, const char *&begin );
+
+    const char *data;
+    std::size_t len;
+    std::size_t pos;
+    bool valid;
+};
+
+/**
+ * @brief Encodes the header frame announcing the length of the next frame
+ */
+std::string encodeHeader( std::uint64_t length );
+
+/**
+ * @brief Decodes a header frame
+ * @returns `false` if fewer than `headerSize()` bytes are given
+ */
+bool decodeHeader( const char *data, std::size_t len, std::uint64_t &length );
+
+constexpr std::size_t headerSize() { return sizeof( std::uint64_t ); }
+
+/**
+ * @brief Flags of an extended header frame
+ */
+enum FrameFlag : std::uint8_t {
+    FlagActivation = 1 << 0, // The message is an `ActivationRecord`
+    FlagBatch = 1 << 1, // The message is a batch of messages, see `encodeBatch()`
+    FlagSequenced = 1 << 2 // The message starts with a 32 bit sequence number
+};
+
+/**
+ * @brief Decoded header frame
+ * A header without topic and flags is the plain 64 bit length. Otherwise the
+ * most significant bit is set, followed by 7 reserved bits, 8 bits of flags,
+ * the 16 bit topic and the 32 bit length.
+ */
+struct FrameHeader {
+    std::uint64_t length = 0;
+    std::uint16_t topic = 0;
+    std::uint8_t flags = 0;
+};
+
+/**
+ * @brief Largest message length an extended header can announce
+ */
+constexpr std::uint64_t maxExtendedLength() { return 0xffffffffu; }
+
+/**
+ * @brief Encodes a header frame, in the plain format if topic and flags are `0`
+ * @returns an empty string if the length does not fit an extended header
+ */
+std::string encodeFrameHeader( const FrameHeader &header );
+
+/**
+ * @brief Decodes a plain or extended header frame
+ * @returns `false` if fewer than `headerSize()` bytes are given
+ */
+bool decodeFrameHeader( const char *data, std::size_t len, FrameHeader &header );
+
+/**
+ * @brief Launch context a secondary instance forwards on activation
+ */
+struct ActivationRecord {
+    std::int64_t timestamp = 0; // Milliseconds since the epoch, UTC
+    std::string workingDirectory;
+    std::vector<std::string> arguments;
+    std::vector<std::pair<std::string, std::string>> environment;
+};
+
+constexpr std::uint8_t activationRecordVersion() { return 1; }
+
+/**
+ * @brief Environment variables an activation forwards by default
+ * @returns `DESKTOP_STARTUP_ID`, `XDG_ACTIVATION_TOKEN`, `DISPLAY` and `WAYLAND_DISPLAY`
+ */
+const std::vector<std::string> &defaultActivationEnvironment();
+
+/**
+ * @brief Encodes an activation record
+ * Layout: version (8 bit), timestamp (64 bit), working directory, argument
+ * count (32 bit) and arguments, variable count (32 bit) and name/value pairs.
+ * Strings are `QByteArray` encoded.
+ */
+std::string encodeActivation( const ActivationRecord &record );
+
+/**
+ * @brief Message inside a batch
+ */
+struct BatchItem {
+    std::uint32_t instanceId = 0;
+    std::uint16_t topic = 0;
+    std::uint8_t flags = 0;
+    std::string payload;
+};
+
+/**
+ * @brief Appends an encoded item to the items of a batch
+ */
+void appendBatchItem( std::string &out, const BatchItem &item );
+
+/**
+ * @brief Encodes a batch: the item count (32 bit) followed by the items
+ */
+std::string encodeBatch( const std::vector<BatchItem> &items );
+
+/**
+ * @brief Decodes a batch
+ * @returns `false` if the batch is truncated or corrupt
+ */
+bool decodeBatch( const char *data, std::size_t len, std::vector<BatchItem> &items );
+
+/**
+ * @brief First byte of the reply a rate limited primary instance sends in
+ * place of an acknowledgement
+ */
+constexpr char busyMarker() { return 'B'; }
+
+/**
+ * @brief Size of a busy reply: the marker followed by the time to wait before
+ * retrying in milliseconds (32 bit)
+ */
+constexpr std::size_t busyReplySize() { return 5; }
+
+std::string encodeBusyReply( std::uint32_t retryAfter );
+
+/**
+ * @brief Decodes a busy reply
+ * @returns `false` if the data is not a complete busy reply
+ */
+bool decodeBusyReply( const char *data, std::size_t len, std::uint32_t &retryAfter );
+
+/**
+ * @brief Encodes an initialisation message including its checksum
+ */
+std::string encodeInitMessage( const InitMessage &message );
+
+/**
+ * @brief Decodes an initialisation message and verifies its checksum
+ * @returns `false` if the message is truncated or corrupt
+ */
+bool decodeInitMessage( const char *data, std::size_t len, InitMessage &message );
+
+#ifdef SINGLEAPPLICATION_CORE_CLIENT
+/**
+ * @brief Path of the Unix domain socket `QLocalServer` listens on for a name
+ */
+std::string serverSocketPath( const std::string &serverName );
+
+/**
+ * @brief Blocking client for a primary instance using plain POSIX sockets
+ */
+class Client {
+public:
+    Client();
+    ~Client();
+
+    Client( const Client& ) = delete;
+    Client &operator=( const Client& ) = delete;
+
+    /**
+     * @brief Connects to the primary instance, retrying until the timeout
+     * expires while the server is not listening yet
+     */
+    bool connectToServer( const std::string &serverName, int msecs );
+
+    /**
+     * @brief Sends the initialisation message of the connection
+     */
+    bool writeInitMessage( const InitMessage &message, int msecs );
+
+    /**
+     * @brief Sends a header and a message frame, each awaiting an acknowledgement
+     * @param topic - topic of the message, `0` for untyped messages
+     * @param flags - `FrameFlag` values describing the message
+     */
+    bool writeConfirmedMessage( const std::string &message, int msecs, std::uint16_t topic = 0, std::uint8_t flags = 0 );
+
+    /**
+     * @brief Sends a single frame and awaits its acknowledgement
+     * @returns `false` on a busy reply too, see `retryAfter()`
+     */
+    bool writeConfirmedFrame( const std::string &frame, int msecs );
+
+    /**
+     * @brief Time a rate limited primary instance asked to wait before retrying
+     * @returns milliseconds, `-1` unless the last frame got a busy reply
+     */
+    int retryAfter() const;
+
+    /**
+     * @brief Reads a header and the frame it announces, as sent by the primary
+     * instance in reply to an `IntrospectionRequest`
+     */
+    bool readFrame( std::string &frame, int msecs );
+
+    /**
+     * @brief Reads exactly `len` bytes sent by the primary instance
+     */
+    bool read( std::string &bytes, std::size_t len, int msecs );
+
+    /**
+     * @brief Blocks until the primary instance closes the connection
+     * @param msecs - timeout, `-1` waits forever
+     */
+    bool waitForDisconnected( int msecs );
+
+    void close();
+    bool isConnected() const;
+    int descriptor() const;
+
+private:
+    bool writeAll( const char *data, std::size_t len, int msecs );
+    bool waitFor( short events, int msecs );
+
+    int fd;
+    int busyRetryAfter;
+};
+
+/**
+ * @brief Path of the Unix domain socket a primary instance in fork server mode
+ * listens on for a server name
+ */
+std::string forkServerPath( const std::string &serverName );
+
+/**
+ * @brief Listens for fork requests, replacing an existing socket of that name
+ * @note Only the current user may connect
+ * @returns non-blocking listening descriptor, `-1` on failure
+ */
+int listenForkServer( const std::string &serverName );
+
+/**
+ * @brief Accepts a fork request: the 32 bit length of an encoded
+ * `ActivationRecord` and the record, with the standard input, output and error
+ * of the requester attached
+ * @param fds - set to the received descriptors, owned by the caller
+ * @returns the connection to reply on, `-1` on failure or if the requester
+ * runs as another user
+ */
+int acceptForkRequest( int listenFd, std::string &activation, int fds[3], int msecs );
+
+/**
+ * @brief Replies the process id of the new instance and closes the connection
+ * @param pid - process id, `-1` if no instance was forked
+ */
+void replyForkRequest( int connection, std::int64_t pid );
+
+/**
+ * @brief Asks a primary instance in fork server mode for a new instance
+ * @param activation - encoded launch context of the new instance
+ * @param fds - standard input, output and error of the new instance, closed
+ * descriptors are replaced by `/dev/null`
+ * @returns process id of the new instance, `-1` on failure
+ */
+std::int64_t requestFork( const std::string &serverName, const std::string &activation, const int fds[3], int msecs );
+
+struct ZygoteResult {
+    int control = -1; // Connection to the zygote, `-1` in new instances
+    bool instance = false; // Whether this process is a new instance
+    std::string activation; // Encoded launch context of a new instance
+};
+
+/**
+ * @brief Forks the zygote, a process that forks new instances of the
+ * application for fork requests
+ * The zygote waits for `serveForkRequests()` and exits when the control
+ * connection is closed. A new instance returns from this function in a copy of
+ * the zygote, with the standard streams of the requester.
+ * @note Call it before any thread is started, the zygote only has the calling
+ * thread
+ */
+ZygoteResult startZygote();
+
+/**
+ * @brief Makes the zygote listen for fork requests on `forkServerPath()`
+ * @param control - the control connection `startZygote()` returned
+ */
+bool serveForkRequests( int control, const std::string &serverName );
+#endif
+
+} // namespace SingleApplicationCore
+
+#endif // SINGLE_APPLICATION_CORE_H
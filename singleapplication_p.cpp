@@ -30,13 +30,27 @@
 // version without notice, or may even be removed.
 //
 
+#include <chrono>
+#include <cmath>
 #include <cstdlib>
 #include <cstddef>
+#include <cstring>
+#include <limits>
+#include <vector>
 
 #include <QtCore/QDir>
+#include <QtCore/QSet>
+#include <QtCore/QFile>
+#include <QtCore/QMutex>
+#include <QtCore/QDebug>
+#include <QtCore/QTimer>
 #include <QtCore/QThread>
+#include <QtCore/QScopedPointer>
 #include <QtCore/QByteArray>
 #include <QtCore/QDataStream>
+#include <QtCore/QStandardPaths>
+#include <QtCore/QJsonArray>
+#include <QtCore/QJsonDocument>
 #include <QtCore/QElapsedTimer>
 #include <QtCore/QCryptographicHash>
 #include <QtNetwork/QLocalServer>
@@ -50,11 +64,19 @@
 
 #include "singleapplication.h"
 #include "singleapplication_p.h"
+#include "singleapplication_core.h"
 
 #ifdef Q_OS_UNIX
     #include <unistd.h>
+    #include <signal.h>
+    #include <errno.h>
     #include <sys/types.h>
     #include <pwd.h>
+    #include <sys/socket.h>
+#endif
+
+#ifdef Q_OS_LINUX
+    #include <sys/epoll.h>
 #endif
 
 #ifdef Q_OS_WIN
@@ -65,12 +87,38 @@
     #include <lmcons.h>
 #endif
 
+Q_LOGGING_CATEGORY(lcSingleApplicationTrace, "singleapplication.trace", QtWarningMsg)
+
 SingleApplicationPrivate::SingleApplicationPrivate( SingleApplication *q_ptr )
     : q_ptr( q_ptr )
 {
+    SingleApplicationTrace::configure();
+
     server = nullptr;
     socket = nullptr;
+    pendingHandshake = false;
     memory = nullptr;
+    heartbeatTimer = nullptr;
+    statsTimer = nullptr;
+    valuesTimer = nullptr;
+    valuesGenerationSeen = 0;
+    coalescingTimer = nullptr;
+    orderingTimer = nullptr;
+    schedulerTimer = nullptr;
+    pollDescriptor = -1;
+    acceptedConnections = 0;
+    schedulingTimeBudget = 0;
+    schedulingByteBudget = 0;
+    nextSequence = 0;
+    standby = false;
+    watchPrimaryRole = false;
+    handoverReceived = false;
+    ready = true;
+    deferredInstanceStarts = 0;
+    spoolTimeToLive = DefaultSpoolTimeToLive;
+    heartbeatTimeout = DefaultHeartbeatTimeout;
+    lastError = SingleApplication::NoError;
+    busyRetryAfter = -1;
     instanceNumber = 0;
 }
 
@@ -82,20 +130,50 @@ SingleApplicationPrivate::~SingleApplicationPrivate()
     }
 
     if( memory != nullptr ){
-        memory->lock();
-        auto *inst = static_cast<InstancesInfo*>(memory->data());
         if( server != nullptr ){
-            server->close();
-            delete server;
-            inst->primary = false;
-            inst->primaryPid = -1;
-            inst->primaryUser[0] =  '\0';
-            inst->checksum = blockChecksum();
+            bool primary = false;
+            if( memory->lock() ){
+                primary = static_cast<InstancesInfo*>( memory->data() )->primaryPid == QCoreApplication::applicationPid();
+                memory->unlock();
+            }
+            if( primary ){
+                stopForkServer();
+                // Exchanges messages with the successor, so it locks the block
+                // only to update it
+                const bool handedOver = handOverPrimaryRole();
+                server->close();
+                delete server;
+                if( ! handedOver && memory->lock() ){
+                    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+                    if( inst->primaryPid == QCoreApplication::applicationPid() ){
+                        inst->primary = false;
+                        inst->primaryPid = -1;
+                        inst->primaryUser[0] =  '\0';
+                        inst->primaryHeartbeat = 0;
+                        inst->checksum = blockChecksum();
+                    }
+                    memory->unlock();
+                }
+            } else {
+                // Another instance took over while this one was unresponsive.
+                // The block belongs to it now and on Unix QLocalServer::close()
+                // would unlink its socket, so the stale server is left to the OS.
+                stopForkServer();
+#ifdef Q_OS_WIN
+                server->close();
+                delete server;
+#endif
+            }
+            server = nullptr;
         }
-        memory->unlock();
 
         delete memory;
     }
+
+#ifdef Q_OS_LINUX
+    if( pollDescriptor >= 0 )
+        ::close( pollDescriptor );
+#endif
 }
 
 QString SingleApplicationPrivate::getUsername()
@@ -131,53 +209,48 @@ QString SingleApplicationPrivate::getUsername()
 
 void SingleApplicationPrivate::genBlockServerName()
 {
-#ifdef Q_OS_MACOS
-    // Maximum key size on macOS is PSHMNAMLEN (31).
-    QCryptographicHash appData( QCryptographicHash::Md5 );
-#else
-    QCryptographicHash appData( QCryptographicHash::Sha256 );
-#endif
-#if QT_VERSION < QT_VERSION_CHECK(6, 3, 0)
-    appData.addData( "SingleApplication", 17 );
-#else
-    appData.addData( QByteArrayView{"SingleApplication"} );
-#endif
-    appData.addData( QCoreApplication::applicationName().toUtf8() );
-    appData.addData( QCoreApplication::organizationName().toUtf8() );
-    appData.addData( QCoreApplication::organizationDomain().toUtf8() );
-
-    if ( ! appDataList.isEmpty() )
-        appData.addData( appDataList.join(QString()).toUtf8() );
-
-    if( ! (options & SingleApplication::Mode::ExcludeAppVersion) ){
-        appData.addData( QCoreApplication::applicationVersion().toUtf8() );
-    }
-
-    if( ! (options & SingleApplication::Mode::ExcludeAppPath) ){
+    SingleApplicationCore::KeyParameters key;
+    key.applicationName = QCoreApplication::applicationName().toUtf8().toStdString();
+    key.organizationName = QCoreApplication::organizationName().toUtf8().toStdString();
+    key.organizationDomain = QCoreApplication::organizationDomain().toUtf8().toStdString();
+    key.applicationVersion = QCoreApplication::applicationVersion().toUtf8().toStdString();
+    key.userData = appDataList.join(QString()).toUtf8().toStdString();
+    key.includeVersion = ! (options & SingleApplication::Mode::ExcludeAppVersion);
+    key.includePath = ! (options & SingleApplication::Mode::ExcludeAppPath);
+    key.includeUser = options & SingleApplication::Mode::User;
+
+    if( key.includePath ){
 #if defined(Q_OS_WIN)
-        appData.addData( QCoreApplication::applicationFilePath().toLower().toUtf8() );
+        key.applicationFilePath = QCoreApplication::applicationFilePath().toLower().toUtf8().toStdString();
 #elif defined(Q_OS_LINUX)
         // If the application is running as an AppImage then the APPIMAGE env var should be used
         // instead of applicationPath() as each instance is launched with its own executable path
         const QByteArray appImagePath = qgetenv( "APPIMAGE" );
         if( appImagePath.isEmpty() ){ // Not running as AppImage: use path to executable file
-            appData.addData( QCoreApplication::applicationFilePath().toUtf8() );
+            key.applicationFilePath = QCoreApplication::applicationFilePath().toUtf8().toStdString();
         } else { // Running as AppImage: Use absolute path to AppImage file
-            appData.addData( appImagePath );
+            key.applicationFilePath = appImagePath.toStdString();
         };
 #else
-        appData.addData( QCoreApplication::applicationFilePath().toUtf8() );
+        key.applicationFilePath = QCoreApplication::applicationFilePath().toUtf8().toStdString();
 #endif
     }
 
-    // User level block requires a user specific data in the hash
-    if( options & SingleApplication::Mode::User ){
-        appData.addData( getUsername().toUtf8() );
-    }
+    if( key.includeUser )
+        key.userName = getUsername().toUtf8().toStdString();
+
+    blockServerName = QString::fromStdString( SingleApplicationCore::blockServerName( key ) );
+}
 
-    // Replace the backslash in RFC 2045 Base64 [a-zA-Z0-9+/=] to comply with
-    // server naming requirements.
-    blockServerName = QString::fromUtf8(appData.result().toBase64().replace("/", "_"));
+QSharedMemory *SingleApplicationPrivate::createMemoryBlock( const QString &key )
+{
+#if QT_VERSION >= QT_VERSION_CHECK(6, 6, 0)
+    //return new QSharedMemory( QNativeIpcKey( key ) ); //old implementation
+    // Use legacy (System V) key type as POSIX realtime shm may not work on macOS
+    return new QSharedMemory( QSharedMemory::legacyNativeKey( key ) );
+#else
+    return new QSharedMemory( key );
+#endif
 }
 
 void SingleApplicationPrivate::initializeMemoryBlock() const
@@ -187,19 +260,28 @@ void SingleApplicationPrivate::initializeMemoryBlock() const
     inst->secondary = 0;
     inst->primaryPid = -1;
     inst->primaryUser[0] =  '\0';
+    inst->primaryHeartbeat = 0;
+    inst->heartbeatTimeout = 0;
     inst->checksum = blockChecksum();
 }
 
 void SingleApplicationPrivate::startPrimary()
 {
+    // Nobody was listening, drop the connection attempt started before the election
+    abandonHandshake();
+
     // Reset the number of connections
     auto *inst = static_cast <InstancesInfo*>( memory->data() );
 
     inst->primary = true;
     inst->primaryPid = QCoreApplication::applicationPid();
     qstrncpy( inst->primaryUser, getUsername().toUtf8().data(), sizeof(inst->primaryUser) );
+    inst->primaryHeartbeat = monotonicMSecs();
+    inst->heartbeatTimeout = heartbeatTimeout;
     inst->checksum = blockChecksum();
     instanceNumber = 0;
+    nextSequence = inst->sequence.load() + 1;
+    primarySince.start();
     // Successful creation means that no main process exists
     // So we start a QLocalServer to listen for connections
     QLocalServer::removeServer( blockServerName );
@@ -213,13 +295,22 @@ void SingleApplicationPrivate::startPrimary()
         server->setSocketOptions( QLocalServer::WorldAccessOption );
     }
 
-    server->listen( blockServerName );
+    if( ! server->listen( blockServerName ) )
+        qWarning() << "SingleApplication: Unable to listen for connections:" << server->errorString();
     QObject::connect(
         server,
         &QLocalServer::newConnection,
         this,
         &SingleApplicationPrivate::slotConnectionEstablished
     );
+
+    startHeartbeat();
+
+    if( options & SingleApplication::Mode::SpoolUndeliveredMessages )
+        replaySpool();
+
+    if( options & SingleApplication::Mode::ForkServer )
+        startForkServer();
 }
 
 void SingleApplicationPrivate::startSecondary()
@@ -231,10 +322,40 @@ void SingleApplicationPrivate::startSecondary()
   instanceNumber = inst->secondary;
 }
 
-bool SingleApplicationPrivate::connectToPrimary( int msecs, ConnectionType connectionType )
+/**
+ * @brief Starts a non-blocking connection attempt that `connectToPrimary()`
+ * picks up, skipping its initial sleep if the attempt succeeded
+ */
+void SingleApplicationPrivate::beginConnectToPrimary()
 {
-    QElapsedTimer time;
-    time.start();
+    TraceScope trace( "beginConnectToPrimary" );
+
+    if( socket == nullptr )
+        socket = new QLocalSocket();
+
+    socket->connectToServer( blockServerName );
+    pendingHandshake = true;
+}
+
+/**
+ * @brief Drops the connection attempt started by `beginConnectToPrimary()`
+ * Without the init message the primary instance would keep it open for as
+ * long as this instance runs.
+ */
+void SingleApplicationPrivate::abandonHandshake()
+{
+    if( pendingHandshake && socket != nullptr ){
+        socket->abort();
+        delete socket;
+        socket = nullptr;
+    }
+    pendingHandshake = false;
+}
+
+bool SingleApplicationPrivate::connectToPrimary( const Deadline &deadline, ConnectionType connectionType )
+{
+    TraceScope trace( "connectToPrimary" );
+    trace.setInstanceId( instanceNumber );
 
     // Connect to the Local Server of the Primary Instance if not already
     // connected.
@@ -242,72 +363,186 @@ bool SingleApplicationPrivate::connectToPrimary( int msecs, ConnectionType conne
         socket = new QLocalSocket();
     }
 
-    if( socket->state() == QLocalSocket::ConnectedState ) return true;
+    // An attempt started before the election may still be under way
+    if( pendingHandshake && socket->state() == QLocalSocket::ConnectingState ){
+        TraceScope connectTrace( "waitForConnected" );
+        socket->waitForConnected( deadline.remaining() );
+    }
+
+    if( socket->state() == QLocalSocket::ConnectedState && ! pendingHandshake ) return true;
+    pendingHandshake = false;
 
     if( socket->state() != QLocalSocket::ConnectedState ){
 
         while( true ){
-            randomSleep();
+            randomSleep( deadline.remaining() );
 
           if( socket->state() != QLocalSocket::ConnectingState )
             socket->connectToServer( blockServerName );
 
           if( socket->state() == QLocalSocket::ConnectingState ){
-              socket->waitForConnected( static_cast<int>(msecs - time.elapsed()) );
+              TraceScope connectTrace( "waitForConnected" );
+              socket->waitForConnected( deadline.remaining() );
           }
 
           // If connected break out of the loop
           if( socket->state() == QLocalSocket::ConnectedState ) break;
 
-          // If elapsed time since start is longer than the method timeout return
-          if( time.elapsed() >= msecs ) return false;
+          // Give up once the deadline passed
+          if( deadline.hasExpired() ) return false;
+
+          stats.connectRetries.fetch_add( 1, std::memory_order_relaxed );
         }
     }
 
-    // Initialisation message according to the SingleApplication protocol
-    QByteArray initMsg;
-    QDataStream writeStream(&initMsg, QIODevice::WriteOnly);
-
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
-    writeStream.setVersion(QDataStream::Qt_5_6);
-#endif
+    return writeInitMessage( deadline, connectionType );
+}
 
-    writeStream << blockServerName.toLatin1();
-    writeStream << static_cast<quint8>(connectionType);
-    writeStream << instanceNumber;
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    quint16 checksum = qChecksum(QByteArray(initMsg.constData(), static_cast<quint32>(initMsg.length())));
-#else
-    quint16 checksum = qChecksum(initMsg.constData(), static_cast<quint32>(initMsg.length()));
-#endif
-    writeStream << checksum;
+bool SingleApplicationPrivate::writeInitMessage( const Deadline &deadline, ConnectionType connectionType )
+{
+    // Initialisation message according to the SingleApplication protocol
+    SingleApplicationCore::InitMessage init;
+    init.serverName = blockServerName.toLatin1().toStdString();
+    init.connectionType = static_cast<SingleApplicationCore::ConnectionType>( connectionType );
+    init.instanceId = instanceNumber;
+    init.pid = QCoreApplication::applicationPid();
 
-    return writeConfirmedMessage( static_cast<int>(msecs - time.elapsed()), initMsg );
+    return writeConfirmedMessage( deadline, QByteArray::fromStdString( SingleApplicationCore::encodeInitMessage( init ) ) );
 }
 
 void SingleApplicationPrivate::writeAck( QLocalSocket *sock ) {
     sock->putChar('\n');
 }
 
-bool SingleApplicationPrivate::writeConfirmedMessage (int msecs, const QByteArray &msg, SingleApplication::SendMode sendMode)
+void SingleApplicationPrivate::writeBusy( QLocalSocket *sock, qint64 retryAfter )
 {
-    QElapsedTimer time;
-    time.start();
+    const std::string reply = SingleApplicationCore::encodeBusyReply( static_cast<quint32>( qBound<qint64>( 1, retryAfter, std::numeric_limits<qint32>::max() ) ) );
+    sock->write( reply.data(), static_cast<qint64>( reply.size() ) );
+    stats.busyReplies.fetch_add( 1, std::memory_order_relaxed );
+}
 
-    // Frame 1: The header indicates the message length that follows
-    QByteArray header;
-    QDataStream headerStream(&header, QIODevice::WriteOnly);
+void TokenBucket::configure( double perSecond, int burst )
+{
+    rate = qMax( perSecond, 0.0 ) / 1000;
+    this->burst = qMax( burst, 1 );
+    tokens = this->burst;
+    updated = -1;
+}
 
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
-    headerStream.setVersion(QDataStream::Qt_5_6);
+qint64 TokenBucket::waitTime( qint64 now )
+{
+    if( updated >= 0 )
+        tokens = qMin( burst, tokens + ( now - updated ) * rate );
+    updated = now;
+
+    if( tokens >= 1 )
+        return 0;
+
+    return static_cast<qint64>( std::ceil( ( 1 - tokens ) / rate ) );
+}
+
+void SingleApplicationPrivate::setRateLimit( SingleApplication::RateLimit limit, double perSecond, int burst )
+{
+    switch( limit ){
+    case SingleApplication::GlobalConnectionLimit:
+        globalConnections.configure( perSecond, burst );
+        break;
+    case SingleApplication::UserConnectionLimit:
+        userConnections.configure( perSecond, burst );
+        connectionsByUser.clear();
+        break;
+    case SingleApplication::GlobalMessageLimit:
+        globalMessages.configure( perSecond, burst );
+        break;
+    case SingleApplication::UserMessageLimit:
+        userMessages.configure( perSecond, burst );
+        messagesByUser.clear();
+        break;
+    }
+}
+
+/**
+ * @brief Takes a token from the buckets of a connection or message
+ * @returns `0` if admitted, otherwise milliseconds until it would be
+ */
+qint64 SingleApplicationPrivate::admit( bool message, qint64 userId )
+{
+    TokenBucket &global = message ? globalMessages : globalConnections;
+    const TokenBucket &userTemplate = message ? userMessages : userConnections;
+    if( ! global.isEnabled() && ! userTemplate.isEnabled() )
+        return 0;
+
+    const qint64 now = monotonicMSecs();
+    TokenBucket *user = nullptr;
+    if( userTemplate.isEnabled() ){
+        QHash<qint64, TokenBucket> &buckets = message ? messagesByUser : connectionsByUser;
+        auto it = buckets.find( userId );
+        if( it == buckets.end() )
+            it = buckets.insert( userId, userTemplate );
+        user = &it.value();
+    }
+
+    // Tokens are only taken once every bucket has one
+    qint64 wait = global.isEnabled() ? global.waitTime( now ) : 0;
+    if( user != nullptr )
+        wait = qMax( wait, user->waitTime( now ) );
+    if( wait > 0 )
+        return wait;
+
+    if( global.isEnabled() )
+        global.take();
+    if( user != nullptr )
+        user->take();
+    return 0;
+}
+
+/**
+ * @brief Looks up the user on the other end of a connection
+ * @returns user id, `-1` where users cannot be told apart
+ */
+qint64 SingleApplicationPrivate::peerUserId( QLocalSocket *sock )
+{
+#if defined(Q_OS_LINUX)
+    struct ucred credentials;
+    socklen_t length = sizeof( credentials );
+    if( getsockopt( static_cast<int>( sock->socketDescriptor() ), SOL_SOCKET, SO_PEERCRED, &credentials, &length ) == 0 )
+        return static_cast<qint64>( credentials.uid );
+#elif defined(Q_OS_UNIX)
+    uid_t uid;
+    gid_t gid;
+    if( getpeereid( static_cast<int>( sock->socketDescriptor() ), &uid, &gid ) == 0 )
+        return static_cast<qint64>( uid );
+#else
+    Q_UNUSED( sock )
 #endif
-    headerStream << static_cast <quint64>( msg.length() );
+    return -1;
+}
+
+bool SingleApplicationPrivate::writeConfirmedMessage (const Deadline &deadline, const QByteArray &msg, SingleApplication::SendMode sendMode, quint16 topic, quint8 flags)
+{
+    QElapsedTimer time;
+    time.start();
+
+    // Frame 1: The header indicates the message length and topic that follows
+    SingleApplicationCore::FrameHeader frameHeader;
+    frameHeader.length = static_cast<quint64>( msg.length() );
+    frameHeader.topic = topic;
+    frameHeader.flags = flags;
+    const QByteArray header = QByteArray::fromStdString( SingleApplicationCore::encodeFrameHeader( frameHeader ) );
+    if( header.isEmpty() ){
+        qWarning() << "SingleApplication: Message on topic" << topic << "exceeds the maximum size.";
+        return false;
+    }
 
-    if( ! writeConfirmedFrame( static_cast<int>(msecs - time.elapsed()), header ))
+    if( ! writeConfirmedFrame( deadline, header ))
         return false;
 
     // Frame 2: The message
-    const bool result = writeConfirmedFrame( static_cast<int>(msecs - time.elapsed()), msg );
+    const bool result = writeConfirmedFrame( deadline, msg );
+    if( result ){
+        stats.sendToAckLatency.record( time.nsecsElapsed() / 1000 );
+        recordAckLatency( time.nsecsElapsed() / 1000 );
+    }
 
     // Block if needed
     if (socket && sendMode == SingleApplication::BlockUntilPrimaryExit)
@@ -316,16 +551,306 @@ bool SingleApplicationPrivate::writeConfirmedMessage (int msecs, const QByteArra
     return result;
 }
 
-bool SingleApplicationPrivate::writeConfirmedFrame( int msecs, const QByteArray &msg )
+bool SingleApplicationPrivate::sendMessage( quint16 topic, quint8 flags, const QByteArray &message, int timeout, SingleApplication::SendMode sendMode )
+{
+    lastError = SingleApplication::NoError;
+    busyRetryAfter = -1;
+    const Deadline deadline( adaptiveTimeout( timeout ) );
+
+    // Nobody to connect to
+    if( server != nullptr ) return false;
+
+    // Don't wait for a primary instance that stopped servicing connections
+    if( primaryUnresponsive() ){
+        lastError = SingleApplication::PrimaryUnresponsiveError;
+        return false;
+    }
+
+    QByteArray payload = message;
+    if( options & SingleApplication::Mode::CollapseLaunchStorms && sendMode == SingleApplication::NonBlocking ){
+        PendingMessage pending;
+        pending.instanceId = instanceNumber;
+        pending.topic = topic;
+        pending.flags = flags;
+        pending.message = message;
+
+        QByteArray batch;
+        switch( stageMessage( deadline, pending, batch ) ){
+        case StagingAppended:
+            return true;
+        case StagingFlush:
+            payload = batch;
+            topic = 0;
+            flags = SingleApplicationCore::FlagBatch;
+            break;
+        case StagingUnavailable:
+            break;
+        }
+    }
+
+    if( options & SingleApplication::Mode::SequenceMessages ){
+        std::string sequence;
+        SingleApplicationCore::appendUInt32( sequence, takeSequence() );
+        payload.prepend( sequence.data(), static_cast<int>( sequence.size() ) );
+        flags |= SingleApplicationCore::FlagSequenced;
+    }
+
+    // Make sure the socket is connected
+    if( connectToPrimary( deadline, Reconnect ) ){
+        if( writeConfirmedMessage( deadline, payload, sendMode, topic, flags ) )
+            return true;
+
+        // The primary instance may have handed over its role while the message was
+        // in flight. The connection is then closed and the successor takes it.
+        if( busyRetryAfter < 0 &&
+            socket->state() != QLocalSocket::ConnectedState &&
+            connectToPrimary( deadline, Reconnect ) &&
+            writeConfirmedMessage( deadline, payload, sendMode, topic, flags ) )
+        {
+            return true;
+        }
+    }
+
+    // The primary instance is alive but asked to retry later
+    if( busyRetryAfter >= 0 ){
+        lastError = SingleApplication::PrimaryBusyError;
+        return false;
+    }
+
+    lastError = deadline.hasExpired() ? SingleApplication::DeadlineExceededError : SingleApplication::ConnectionFailedError;
+
+    if( options & SingleApplication::Mode::SpoolUndeliveredMessages ){
+        PendingMessage pending;
+        pending.instanceId = instanceNumber;
+        pending.topic = topic;
+        pending.flags = flags;
+        pending.message = payload;
+        if( spoolMessage( pending ) ){
+            lastError = SingleApplication::NoError;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * @brief Journal of undelivered messages, next to other runtime files of the user
+ */
+QString SingleApplicationPrivate::spoolFileName() const
+{
+    QString dir = QStandardPaths::writableLocation( QStandardPaths::RuntimeLocation );
+    if( dir.isEmpty() )
+        dir = QDir::tempPath();
+
+    return dir + QLatin1Char( '/' ) + blockServerName + QStringLiteral( ".spool" );
+}
+
+/**
+ * @brief Appends a message to the spool
+ * Each record holds the expiry in milliseconds since the epoch (64 bit), the
+ * instance id (32 bit), topic (16 bit), flags (8 bit) and the message.
+ */
+bool SingleApplicationPrivate::spoolMessage( const PendingMessage &message )
+{
+    std::string record;
+    SingleApplicationCore::appendUInt64( record, static_cast<quint64>( QDateTime::currentMSecsSinceEpoch() + spoolTimeToLive ) );
+    SingleApplicationCore::appendUInt32( record, message.instanceId );
+    SingleApplicationCore::appendUInt16( record, message.topic );
+    SingleApplicationCore::appendUInt8( record, message.flags );
+    SingleApplicationCore::appendBytes( record, message.message.toStdString() );
+
+    // The memory lock serialises writers with the primary instance replaying the spool
+    if( ! lockMemory() ){
+        qWarning() << "SingleApplication: Unable to lock memory to spool a message.";
+        return false;
+    }
+
+    QFile file( spoolFileName() );
+    const bool written = file.open( QIODevice::WriteOnly | QIODevice::Append ) &&
+                         file.write( record.data(), static_cast<qint64>( record.size() ) ) == static_cast<qint64>( record.size() ) &&
+                         file.flush();
+    if( written && options & SingleApplication::Mode::User )
+        file.setPermissions( QFileDevice::ReadOwner | QFileDevice::WriteOwner );
+    file.close();
+
+    if( ! memory->unlock() ){
+        qDebug() << "SingleApplication: Unable to unlock memory after spooling a message.";
+        qDebug() << memory->errorString();
+    }
+
+    if( ! written )
+        qWarning() << "SingleApplication: Unable to spool a message:" << file.errorString();
+
+    return written;
+}
+
+/**
+ * @brief Queues unexpired spooled messages for delivery and empties the spool
+ * @note Called with the memory locked
+ */
+void SingleApplicationPrivate::replaySpool()
+{
+    QFile file( spoolFileName() );
+    if( ! file.exists() || ! file.open( QIODevice::ReadWrite ) )
+        return;
+
+    const qint64 size = file.size();
+    const uchar *data = size > 0 ? file.map( 0, size ) : nullptr;
+    if( data != nullptr ){
+        const qint64 now = QDateTime::currentMSecsSinceEpoch();
+        SingleApplicationCore::Reader reader( reinterpret_cast<const char*>( data ), static_cast<std::size_t>( size ) );
+        while( reader.position() < static_cast<std::size_t>( size ) ){
+            std::uint64_t expiresAt = 0;
+            PendingMessage pending;
+            const char *begin = nullptr;
+            std::size_t length = 0;
+            reader.readUInt64( expiresAt );
+            reader.readUInt32( pending.instanceId );
+            reader.readUInt16( pending.topic );
+            reader.readUInt8( pending.flags );
+            reader.readBytesView( begin, length );
+
+            // A writer that died mid-record leaves a truncated tail
+            if( ! reader.ok() ) break;
+
+            if( static_cast<qint64>( expiresAt ) < now ) continue;
+
+            pending.message = QByteArray( begin, static_cast<int>( length ) );
+            pendingMessages.append( pending );
+        }
+        file.unmap( const_cast<uchar*>( data ) );
+    }
+
+    file.resize( 0 );
+    file.close();
+
+    // Delivered once the event loop runs, ahead of messages from new connections
+    if( ! pendingMessages.isEmpty() )
+        QTimer::singleShot( 0, this, &SingleApplicationPrivate::slotDeliverPendingMessages );
+}
+
+/**
+ * @brief Appends a message to the batch in the staging area if another
+ * instance is about to forward it. Otherwise opens a batch, waits for the
+ * launch storm window to pass and takes everything staged meanwhile.
+ * @param batch - set to the encoded batch on `StagingFlush`
+ */
+SingleApplicationPrivate::StagingResult SingleApplicationPrivate::stageMessage( const Deadline &deadline, const PendingMessage &message, QByteArray &batch )
+{
+    SingleApplicationCore::BatchItem item;
+    item.instanceId = message.instanceId;
+    item.topic = message.topic;
+    item.flags = message.flags;
+    item.payload = message.message.toStdString();
+
+    std::string encoded;
+    SingleApplicationCore::appendBatchItem( encoded, item );
+    if( encoded.size() > sizeof( StagingArea::data ) )
+        return StagingUnavailable;
+
+    QScopedPointer<QSharedMemory> staging( createMemoryBlock( blockServerName + QStringLiteral( "-staging" ) ) );
+    if( ! staging->create( sizeof( StagingArea ) ) && ! staging->attach() )
+        return StagingUnavailable;
+
+    if( staging->size() < static_cast<int>( sizeof( StagingArea ) ) || ! staging->lock() )
+        return StagingUnavailable;
+
+    auto *area = static_cast<StagingArea*>( staging->data() );
+    if( area->magic != StagingMagic ){
+        area->magic = StagingMagic;
+        area->count = 0;
+        area->used = 0;
+        area->flusherPid = 0;
+        area->windowStart = 0;
+    }
+
+    const bool fits = area->used + encoded.size() <= sizeof( StagingArea::data );
+    const bool batchOpen = area->flusherPid != 0 && isProcessRunning( area->flusherPid ) &&
+                           monotonicMSecs() - area->windowStart < LaunchStormWindow;
+
+    if( batchOpen && ! fits ){
+        staging->unlock();
+        return StagingUnavailable;
+    }
+
+    // Items of a batch whose flusher died are adopted
+    if( ! batchOpen && ! fits ){
+        area->count = 0;
+        area->used = 0;
+    }
+
+    std::memcpy( area->data + area->used, encoded.data(), encoded.size() );
+    area->used += static_cast<quint32>( encoded.size() );
+    area->count += 1;
+
+    if( batchOpen ){
+        staging->unlock();
+        return StagingAppended;
+    }
+
+    area->flusherPid = QCoreApplication::applicationPid();
+    area->windowStart = monotonicMSecs();
+    staging->unlock();
+
+    // Staying attached keeps the block alive while the window is open. The
+    // window is cut short if less of the deadline is left.
+    const int window = deadline.remaining() < 0 ? static_cast<int>( LaunchStormWindow ) : qMin( static_cast<int>( LaunchStormWindow ), deadline.remaining() );
+    QThread::msleep( static_cast<unsigned long>( window ) );
+
+    if( ! staging->lock() )
+        return StagingUnavailable;
+
+    // A late instance adopted the batch after the window and forwarded it
+    if( area->count == 0 || area->flusherPid != QCoreApplication::applicationPid() ){
+        staging->unlock();
+        return StagingAppended;
+    }
+
+    std::string encodedBatch;
+    SingleApplicationCore::appendUInt32( encodedBatch, area->count );
+    encodedBatch.append( area->data, area->used );
+    area->count = 0;
+    area->used = 0;
+    area->flusherPid = 0;
+    staging->unlock();
+
+    batch = QByteArray::fromStdString( encodedBatch );
+    return StagingFlush;
+}
+
+bool SingleApplicationPrivate::writeConfirmedFrame( const Deadline &deadline, const QByteArray &msg )
 {
+    TraceScope trace( "writeConfirmedFrame" );
+    trace.setInstanceId( instanceNumber );
+    trace.setBytes( msg.size() );
+
     socket->write( msg );
     socket->flush();
 
-    // Clamp negative msecs to -1 (Qt6's "wait forever" sentinel for waitForReadyRead)
-    bool result = socket->waitForReadyRead( msecs < 0 ? -1 : msecs ); // await ack byte
+    // remaining() is -1 without a deadline, which waitForReadyRead() takes as forever
+    bool result = socket->waitForReadyRead( deadline.remaining() ); // await ack byte
     if (result) {
-        socket->read( 1 );
-        return true;
+        const QByteArray ack = socket->read( 1 );
+        if( ack.isEmpty() || ack.at( 0 ) != SingleApplicationCore::busyMarker() )
+            return true;
+
+        // A rate limited primary instance writes the whole busy reply at once
+        QByteArray reply = ack;
+        while( reply.size() < static_cast<int>( SingleApplicationCore::busyReplySize() ) ){
+            reply.append( socket->read( static_cast<qint64>( SingleApplicationCore::busyReplySize() ) - reply.size() ) );
+            if( reply.size() < static_cast<int>( SingleApplicationCore::busyReplySize() ) &&
+                ! socket->waitForReadyRead( deadline.remaining() ) )
+            {
+                break;
+            }
+        }
+
+        std::uint32_t retryAfter = 0;
+        busyRetryAfter = SingleApplicationCore::decodeBusyReply( reply.constData(), static_cast<std::size_t>( reply.size() ), retryAfter )
+                         ? static_cast<int>( qMin<std::uint32_t>( retryAfter, std::numeric_limits<int>::max() ) )
+                         : 0;
+        return false;
     }
 
     return false;
@@ -333,12 +858,7 @@ bool SingleApplicationPrivate::writeConfirmedFrame( int msecs, const QByteArray
 
 quint16 SingleApplicationPrivate::blockChecksum() const
 {
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    quint16 checksum = qChecksum(QByteArray(static_cast<const char*>(memory->constData()), offsetof(InstancesInfo, checksum)));
-#else
-    quint16 checksum = qChecksum(static_cast<const char*>(memory->constData()), offsetof(InstancesInfo, checksum));
-#endif
-    return checksum;
+    return SingleApplicationCore::checksum( static_cast<const char*>( memory->constData() ), offsetof( InstancesInfo, checksum ) );
 }
 
 qint64 SingleApplicationPrivate::primaryPid() const
@@ -365,149 +885,1937 @@ QString SingleApplicationPrivate::primaryUser() const
     return QString::fromUtf8( username );
 }
 
-/**
- * @brief Executed when a connection has been made to the LocalServer
- */
-void SingleApplicationPrivate::slotConnectionEstablished()
+bool SingleApplicationPrivate::primaryUnresponsive() const
 {
-    QLocalSocket *nextConnSocket = server->nextPendingConnection();
-    connectionMap.insert(nextConnSocket, ConnectionInfo());
+    bool unresponsive;
 
-    QObject::connect(nextConnSocket, &QLocalSocket::aboutToClose, this,
-        [nextConnSocket, this](){
-            auto &info = connectionMap[nextConnSocket];
-            this->slotClientConnectionClosed( nextConnSocket, info.instanceId );
-        }
-    );
+    memory->lock();
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    unresponsive = heartbeatExpired( inst );
+    memory->unlock();
 
-    QObject::connect(nextConnSocket, &QLocalSocket::disconnected, nextConnSocket, &QLocalSocket::deleteLater);
+    return unresponsive;
+}
 
-    QObject::connect(nextConnSocket, &QLocalSocket::destroyed, this,
-        [nextConnSocket, this](){
-            connectionMap.remove(nextConnSocket);
-        }
-    );
+/**
+ * @brief Checks whether the primary instance recorded in the block stopped
+ * updating its heartbeat. Expects the memory block to be locked.
+ */
+bool SingleApplicationPrivate::heartbeatExpired( const InstancesInfo *inst )
+{
+    if( ! inst->primary || inst->heartbeatTimeout <= 0 )
+        return false;
 
-    QObject::connect(nextConnSocket, &QLocalSocket::readyRead, this,
-        [nextConnSocket, this](){
-            auto &info = connectionMap[nextConnSocket];
-            switch(info.stage){
-            case StageInitHeader:
-                readMessageHeader( nextConnSocket, StageInitBody );
-                break;
-            case StageInitBody:
-                readInitMessageBody(nextConnSocket);
-                break;
-            case StageConnectedHeader:
-                readMessageHeader( nextConnSocket, StageConnectedBody );
-                break;
-            case StageConnectedBody:
-                this->slotDataAvailable( nextConnSocket, info.instanceId );
-                break;
-            default:
-                break;
-            };
-        }
-    );
+    return monotonicMSecs() - inst->primaryHeartbeat > inst->heartbeatTimeout;
 }
 
-void SingleApplicationPrivate::readMessageHeader( QLocalSocket *sock, SingleApplicationPrivate::ConnectionStage nextStage )
+/**
+ * @brief Milliseconds on a monotonic clock that is comparable between processes
+ */
+qint64 SingleApplicationPrivate::monotonicMSecs()
 {
-    if (!connectionMap.contains( sock )){
-        return;
+    QElapsedTimer clock;
+    clock.start();
+    return clock.msecsSinceReference();
+}
+
+void SingleApplicationPrivate::startHeartbeat()
+{
+    if( heartbeatTimer == nullptr ){
+        heartbeatTimer = new QTimer( this );
+        QObject::connect(
+            heartbeatTimer,
+            &QTimer::timeout,
+            this,
+            &SingleApplicationPrivate::slotHeartbeat
+        );
     }
 
-    if( sock->bytesAvailable() < ( qint64 )sizeof( quint64 ) ){
+    if( heartbeatTimeout <= 0 ){
+        heartbeatTimer->stop();
         return;
     }
 
-    QDataStream headerStream( sock );
-
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
-    headerStream.setVersion( QDataStream::Qt_5_6 );
-#endif
-
-    // Read the header to know the message length
-    quint64 msgLen = 0;
-    headerStream >> msgLen;
-    ConnectionInfo &info = connectionMap[sock];
-    info.stage = nextStage;
-    info.msgLen = msgLen;
+    // Several heartbeats fit in the threshold so a single late timer
+    // does not mark the primary as unresponsive
+    heartbeatTimer->start( qMax( heartbeatTimeout / 4, static_cast<int>( MinimumHeartbeatInterval ) ) );
+}
 
-    writeAck( sock );
+/**
+ * @brief Locks the memory block and accounts the time spent waiting for it
+ */
+bool SingleApplicationPrivate::lockMemory()
+{
+    TraceScope trace( "lockMemory" );
+    QElapsedTimer wait;
+    wait.start();
+    const bool locked = memory->lock();
+    stats.lockWaitTime.fetch_add( wait.nsecsElapsed() / 1000, std::memory_order_relaxed );
+    return locked;
 }
 
-bool SingleApplicationPrivate::isFrameComplete( QLocalSocket *sock )
+void SingleApplicationPrivate::setStatsInterval( int msecs )
 {
-    if (!connectionMap.contains( sock )){
-        return false;
+    if( statsTimer == nullptr ){
+        statsTimer = new QTimer( this );
+        QObject::connect(
+            statsTimer,
+            &QTimer::timeout,
+            this,
+            &SingleApplicationPrivate::slotStatsTimeout
+        );
     }
 
-    ConnectionInfo &info = connectionMap[sock];
-    if( sock->bytesAvailable() < ( qint64 )info.msgLen ){
-        return false;
+    if( msecs > 0 ){
+        statsTimer->start( msecs );
+    } else {
+        statsTimer->stop();
     }
+}
 
-    return true;
+void SingleApplicationPrivate::slotStatsTimeout()
+{
+    Q_Q( SingleApplication );
+    Q_EMIT q->statsUpdated( stats.snapshot() );
 }
 
-void SingleApplicationPrivate::readInitMessageBody( QLocalSocket *sock )
+/**
+ * @brief Index of the slot holding a key, -1 if the key is not set
+ * @note Without the lock the result is only valid if the generation did not
+ * change meanwhile.
+ */
+int SingleApplicationPrivate::findSharedValue( const InstancesInfo *inst, const QByteArray &key )
 {
-    Q_Q(SingleApplication);
+    for( int i = 0; i < SingleApplication::MaximumSharedValues; ++i ){
+        const SharedValue &slot = inst->values[i];
+        if( slot.keySize == key.size() && std::memcmp( slot.key, key.constData(), static_cast<std::size_t>( key.size() ) ) == 0 )
+            return i;
+    }
+    return -1;
+}
 
-    if( !isFrameComplete( sock ) )
-        return;
+/**
+ * @brief Stores or, if `value` is `nullptr`, removes a shared value
+ */
+bool SingleApplicationPrivate::writeSharedValue( const QString &key, const QByteArray *value )
+{
+    const QByteArray name = key.toUtf8();
+    if( memory == nullptr || name.isEmpty() || name.size() > SingleApplication::MaximumSharedKeySize )
+        return false;
+    if( value != nullptr && value->size() > SingleApplication::MaximumSharedValueSize )
+        return false;
 
-    // Read the message body
-    QByteArray msgBytes = sock->readAll();
-    QDataStream readStream(msgBytes);
+    if( ! lockMemory() ){
+        qDebug() << "SingleApplication: Unable to lock memory to write a shared value.";
+        return false;
+    }
 
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
-    readStream.setVersion( QDataStream::Qt_5_6 );
-#endif
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    int index = findSharedValue( inst, name );
+    if( index < 0 && value != nullptr ){
+        for( int i = 0; i < SingleApplication::MaximumSharedValues && index < 0; ++i ){
+            if( inst->values[i].keySize == 0 ) index = i;
+        }
+    }
+
+    bool result = index >= 0 || value == nullptr;
+    const bool unchanged = index >= 0 && value != nullptr && inst->values[index].keySize == name.size() &&
+                           QByteArray::fromRawData( inst->values[index].value, inst->values[index].valueSize ) == *value;
+
+    if( index >= 0 && ! unchanged ){
+        // Readers retry while the generation is odd or has moved on
+        quint32 generation = inst->valuesGeneration.load( std::memory_order_relaxed );
+        if( generation % 2 != 0 ) ++generation; // A writer died halfway
+        inst->valuesGeneration.store( generation + 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_release );
+
+        SharedValue &slot = inst->values[index];
+        if( value == nullptr ){
+            slot.keySize = 0;
+            slot.valueSize = 0;
+        } else {
+            slot.keySize = static_cast<quint8>( name.size() );
+            std::memcpy( slot.key, name.constData(), static_cast<std::size_t>( name.size() ) );
+            slot.valueSize = static_cast<quint16>( value->size() );
+            std::memcpy( slot.value, value->constData(), static_cast<std::size_t>( value->size() ) );
+        }
+
+        inst->valuesGeneration.store( generation + 2, std::memory_order_release );
+    }
+
+    if( ! memory->unlock() ){
+        qDebug() << "SingleApplication: Unable to unlock memory after writing a shared value.";
+        qDebug() << memory->errorString();
+    }
+
+    return result;
+}
+
+/**
+ * @brief Reads a shared value without the lock and without writing to the
+ * memory block. Gives up if writers keep interfering or one of them died
+ * halfway, which the next writer repairs.
+ */
+QByteArray SingleApplicationPrivate::sharedValue( const QString &key, const QByteArray &defaultValue ) const
+{
+    const QByteArray name = key.toUtf8();
+    if( memory == nullptr || name.isEmpty() || name.size() > SingleApplication::MaximumSharedKeySize )
+        return defaultValue;
+
+    const auto *inst = static_cast<const InstancesInfo*>( memory->constData() );
+    for( int attempt = 0; attempt < SharedValueReadAttempts; ++attempt ){
+        const quint32 generation = inst->valuesGeneration.load( std::memory_order_acquire );
+        if( generation % 2 != 0 ){
+            QThread::yieldCurrentThread();
+            continue;
+        }
+
+        const int index = findSharedValue( inst, name );
+        QByteArray value = defaultValue;
+        if( index >= 0 )
+            value = QByteArray( inst->values[index].value, qMin<int>( inst->values[index].valueSize, SingleApplication::MaximumSharedValueSize ) );
+
+        std::atomic_thread_fence( std::memory_order_acquire );
+        if( inst->valuesGeneration.load( std::memory_order_relaxed ) == generation )
+            return value;
+    }
+
+    qDebug() << "SingleApplication: Shared values kept changing while reading them.";
+    return defaultValue;
+}
+
+void SingleApplicationPrivate::setSharedValuesInterval( int msecs )
+{
+    if( valuesTimer == nullptr ){
+        valuesTimer = new QTimer( this );
+        QObject::connect(
+            valuesTimer,
+            &QTimer::timeout,
+            this,
+            &SingleApplicationPrivate::slotSharedValuesTimeout
+        );
+    }
+
+    if( msecs > 0 && memory != nullptr ){
+        if( ! valuesTimer->isActive() )
+            valuesGenerationSeen = static_cast<const InstancesInfo*>( memory->constData() )->valuesGeneration.load( std::memory_order_acquire );
+        valuesTimer->start( msecs );
+    } else {
+        valuesTimer->stop();
+    }
+}
+
+/**
+ * @brief Emits `sharedValuesChanged()` if the generation moved on since the
+ * last check. An odd generation is left to the next check.
+ */
+void SingleApplicationPrivate::slotSharedValuesTimeout()
+{
+    Q_Q( SingleApplication );
+
+    const quint32 generation = static_cast<const InstancesInfo*>( memory->constData() )->valuesGeneration.load( std::memory_order_acquire );
+    if( generation % 2 != 0 || generation == valuesGenerationSeen )
+        return;
+
+    valuesGenerationSeen = generation;
+    Q_EMIT q->sharedValuesChanged();
+}
+
+std::atomic<bool> SingleApplicationTrace::active{ false };
+
+namespace {
+    QMutex traceMutex;
+    QFile *traceFile = nullptr;
+}
+
+/**
+ * @brief Picks up the trace file from the environment and whether the logging
+ * category is enabled. Executed whenever a `SingleApplicationPrivate` is created.
+ */
+void SingleApplicationTrace::configure()
+{
+    static bool environmentRead = false;
+    if( ! environmentRead ){
+        environmentRead = true;
+        const QString fileName = QString::fromLocal8Bit( qgetenv( "SINGLEAPPLICATION_TRACE_FILE" ) );
+        if( ! fileName.isEmpty() )
+            setFile( fileName );
+    }
+
+    updateActive();
+}
+
+bool SingleApplicationTrace::setFile( const QString &fileName )
+{
+    {
+        QMutexLocker locker( &traceMutex );
+
+        delete traceFile;
+        traceFile = nullptr;
+
+        if( ! fileName.isEmpty() ){
+            // Several processes may share the file, every event is appended
+            // with a single write
+            QString path = fileName;
+            path.replace( QStringLiteral( "%p" ), QString::number( QCoreApplication::applicationPid() ) );
+
+            traceFile = new QFile( path );
+            if( traceFile->open( QIODevice::WriteOnly | QIODevice::Append ) ){
+                // JSON array format, the closing bracket is optional
+                if( traceFile->size() == 0 ){
+                    traceFile->write( "[\n" );
+                    traceFile->flush();
+                }
+            } else {
+                qWarning() << "SingleApplication: Unable to open trace file" << path << traceFile->errorString();
+                delete traceFile;
+                traceFile = nullptr;
+            }
+        }
+    }
+
+    updateActive();
+    return fileName.isEmpty() || traceFile != nullptr;
+}
+
+void SingleApplicationTrace::updateActive()
+{
+    QMutexLocker locker( &traceMutex );
+    active.store( traceFile != nullptr || lcSingleApplicationTrace().isDebugEnabled(), std::memory_order_relaxed );
+}
+
+/**
+ * @brief Microseconds on a monotonic clock shared by all processes, so that
+ * events of the primary and secondary instances line up
+ */
+qint64 SingleApplicationTrace::timestamp()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+void SingleApplicationTrace::complete( const char *name, qint64 start, qint64 instanceId, qint64 bytes )
+{
+    const qint64 duration = timestamp() - start;
+
+    qCDebug( lcSingleApplicationTrace ).nospace() << name << " instanceId=" << instanceId
+                                                  << " bytes=" << bytes << " duration=" << duration << "us";
+
+    QMutexLocker locker( &traceMutex );
+    if( traceFile == nullptr )
+        return;
+
+    QByteArray event;
+    event.reserve( 256 );
+    event += "{\"name\":\"";
+    event += name;
+    event += "\",\"cat\":\"singleapplication\",\"ph\":\"X\",\"ts\":";
+    event += QByteArray::number( start );
+    event += ",\"dur\":";
+    event += QByteArray::number( duration );
+    event += ",\"pid\":";
+    event += QByteArray::number( QCoreApplication::applicationPid() );
+    event += ",\"tid\":";
+    event += QByteArray::number( reinterpret_cast<quintptr>( QThread::currentThreadId() ) );
+    event += ",\"args\":{\"instanceId\":";
+    event += QByteArray::number( instanceId );
+    event += ",\"bytes\":";
+    event += QByteArray::number( bytes );
+    event += "}},\n";
+
+    traceFile->write( event );
+    traceFile->flush();
+}
+
+/**
+ * @brief Compact JSON snapshot of the connections, queues, memory block and
+ * counters of the primary instance, sent in reply to an introspection request
+ */
+QByteArray SingleApplicationPrivate::introspectionSnapshot()
+{
+    QJsonObject block;
+    if( memory->lock() ){
+        const auto *inst = static_cast<const InstancesInfo*>( memory->constData() );
+        block.insert( QStringLiteral( "primary" ), inst->primary );
+        block.insert( QStringLiteral( "secondary" ), static_cast<qint64>( inst->secondary ) );
+        block.insert( QStringLiteral( "primaryPid" ), inst->primaryPid );
+        block.insert( QStringLiteral( "primaryUser" ), QString::fromUtf8( inst->primaryUser ) );
+        block.insert( QStringLiteral( "heartbeatAge" ), monotonicMSecs() - inst->primaryHeartbeat );
+        block.insert( QStringLiteral( "heartbeatTimeout" ), inst->heartbeatTimeout );
+        block.insert( QStringLiteral( "checksumValid" ), inst->checksum == blockChecksum() );
+        block.insert( QStringLiteral( "sequence" ), static_cast<qint64>( inst->sequence.load() ) );
+        block.insert( QStringLiteral( "ackLatencyP50" ), inst->ackLatencyP50.load() );
+        block.insert( QStringLiteral( "ackLatencyP99" ), inst->ackLatencyP99.load() );
+        block.insert( QStringLiteral( "valuesGeneration" ), static_cast<qint64>( inst->valuesGeneration.load() ) );
+        memory->unlock();
+    }
+
+    QJsonArray connections;
+    for( auto it = connectionMap.constBegin(); it != connectionMap.constEnd(); ++it ){
+        QJsonObject connection;
+        connection.insert( QStringLiteral( "instanceId" ), static_cast<qint64>( it.value().instanceId ) );
+        connection.insert( QStringLiteral( "connectionType" ), it.value().connectionType );
+        connection.insert( QStringLiteral( "stage" ), it.value().stage );
+        connection.insert( QStringLiteral( "pid" ), it.value().pid );
+        connection.insert( QStringLiteral( "msgLen" ), it.value().msgLen );
+        connection.insert( QStringLiteral( "bytesBuffered" ), it.key()->bytesAvailable() );
+        connections.append( connection );
+    }
+
+    QJsonObject snapshot;
+    snapshot.insert( QStringLiteral( "version" ), 1 );
+    snapshot.insert( QStringLiteral( "pid" ), QCoreApplication::applicationPid() );
+    snapshot.insert( QStringLiteral( "uptime" ), primarySince.isValid() ? primarySince.elapsed() : 0 );
+    snapshot.insert( QStringLiteral( "instancesInfo" ), block );
+    snapshot.insert( QStringLiteral( "connections" ), connections );
+    snapshot.insert( QStringLiteral( "ready" ), ready );
+    snapshot.insert( QStringLiteral( "queuedMessages" ), static_cast<qint64>( pendingMessages.size() + coalescingBuffer.size() + reorderBuffer.size() ) );
+    snapshot.insert( QStringLiteral( "stats" ), statsToJson( stats.snapshot() ) );
+
+    return QJsonDocument( snapshot ).toJson( QJsonDocument::Compact );
+}
+
+QJsonObject SingleApplicationPrivate::statsToJson( const SingleApplication::Stats &stats )
+{
+    auto histogramToJson = []( const SingleApplication::Histogram &histogram ){
+        QJsonArray buckets;
+        for( quint64 bucket : histogram.buckets )
+            buckets.append( static_cast<qint64>( bucket ) );
+
+        QJsonObject object;
+        object.insert( QStringLiteral( "count" ), static_cast<qint64>( histogram.count ) );
+        object.insert( QStringLiteral( "sum" ), static_cast<qint64>( histogram.sum ) );
+        object.insert( QStringLiteral( "max" ), static_cast<qint64>( histogram.max ) );
+        object.insert( QStringLiteral( "p50" ), static_cast<qint64>( histogram.percentile( 50 ) ) );
+        object.insert( QStringLiteral( "p99" ), static_cast<qint64>( histogram.percentile( 99 ) ) );
+        object.insert( QStringLiteral( "buckets" ), buckets );
+        return object;
+    };
+
+    QJsonObject object;
+    object.insert( QStringLiteral( "electionTime" ), stats.electionTime );
+    object.insert( QStringLiteral( "lockWaitTime" ), stats.lockWaitTime );
+    object.insert( QStringLiteral( "connectRetries" ), static_cast<qint64>( stats.connectRetries ) );
+    object.insert( QStringLiteral( "messagesReceived" ), static_cast<qint64>( stats.messagesReceived ) );
+    object.insert( QStringLiteral( "bytesReceived" ), static_cast<qint64>( stats.bytesReceived ) );
+    object.insert( QStringLiteral( "connectionCount" ), stats.connectionCount );
+    object.insert( QStringLiteral( "busyReplies" ), static_cast<qint64>( stats.busyReplies ) );
+    object.insert( QStringLiteral( "headerParseTime" ), histogramToJson( stats.headerParseTime ) );
+    object.insert( QStringLiteral( "initParseTime" ), histogramToJson( stats.initParseTime ) );
+    object.insert( QStringLiteral( "messageParseTime" ), histogramToJson( stats.messageParseTime ) );
+    object.insert( QStringLiteral( "sendToAckLatency" ), histogramToJson( stats.sendToAckLatency ) );
+    return object;
+}
+
+HistogramCounters::HistogramCounters()
+{
+    for( std::atomic<quint64> &bucket : buckets )
+        bucket.store( 0, std::memory_order_relaxed );
+    count.store( 0, std::memory_order_relaxed );
+    sum.store( 0, std::memory_order_relaxed );
+    max.store( 0, std::memory_order_relaxed );
+}
+
+void HistogramCounters::record( qint64 usecs )
+{
+    const quint64 value = usecs > 0 ? static_cast<quint64>( usecs ) : 0;
+
+    // Index of the highest set bit, so that bucket i holds [2^(i-1), 2^i)
+    int bucket = 0;
+    for( quint64 rest = value; rest != 0 && bucket < SingleApplication::Histogram::BucketCount - 1; rest >>= 1 )
+        ++bucket;
+
+    buckets[bucket].fetch_add( 1, std::memory_order_relaxed );
+    count.fetch_add( 1, std::memory_order_relaxed );
+    sum.fetch_add( value, std::memory_order_relaxed );
+
+    quint64 currentMax = max.load( std::memory_order_relaxed );
+    while( value > currentMax && ! max.compare_exchange_weak( currentMax, value, std::memory_order_relaxed ) ){}
+}
+
+SingleApplication::Histogram HistogramCounters::snapshot() const
+{
+    SingleApplication::Histogram histogram;
+    for( int i = 0; i < SingleApplication::Histogram::BucketCount; ++i )
+        histogram.buckets[i] = buckets[i].load( std::memory_order_relaxed );
+    histogram.count = count.load( std::memory_order_relaxed );
+    histogram.sum = sum.load( std::memory_order_relaxed );
+    histogram.max = max.load( std::memory_order_relaxed );
+    return histogram;
+}
+
+SingleApplication::Stats StatsCounters::snapshot() const
+{
+    SingleApplication::Stats snapshot;
+    snapshot.electionTime = electionTime.load( std::memory_order_relaxed );
+    snapshot.lockWaitTime = lockWaitTime.load( std::memory_order_relaxed );
+    snapshot.connectRetries = connectRetries.load( std::memory_order_relaxed );
+    snapshot.messagesReceived = messagesReceived.load( std::memory_order_relaxed );
+    snapshot.bytesReceived = bytesReceived.load( std::memory_order_relaxed );
+    snapshot.connectionCount = connectionCount.load( std::memory_order_relaxed );
+    snapshot.busyReplies = busyReplies.load( std::memory_order_relaxed );
+    snapshot.headerParseTime = headerParseTime.snapshot();
+    snapshot.initParseTime = initParseTime.snapshot();
+    snapshot.messageParseTime = messageParseTime.snapshot();
+    snapshot.sendToAckLatency = sendToAckLatency.snapshot();
+    return snapshot;
+}
+
+void SingleApplicationPrivate::setHeartbeatTimeout( int msecs )
+{
+    heartbeatTimeout = qMax( msecs, 0 );
+
+    if( server == nullptr )
+        return;
+
+    slotHeartbeat();
+    startHeartbeat();
+}
+
+/**
+ * @brief Executed periodically on the primary instance to prove it still
+ * services its event loop
+ */
+void SingleApplicationPrivate::slotHeartbeat()
+{
+    if( ! memory->lock() ){
+        qDebug() << "SingleApplication: Unable to lock memory for heartbeat.";
+        return;
+    }
+
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    if( inst->primaryPid == QCoreApplication::applicationPid() ){
+        inst->primaryHeartbeat = monotonicMSecs();
+        inst->heartbeatTimeout = heartbeatTimeout;
+        inst->checksum = blockChecksum();
+        if( options & SingleApplication::Mode::AdaptiveTimeouts )
+            publishAckLatency( inst );
+    } else {
+        qWarning() << "SingleApplication: Another instance has taken over the primary role.";
+        heartbeatTimer->stop();
+    }
+
+    memory->unlock();
+}
+
+/**
+ * @brief Reports the latency of an acknowledged message to the primary instance
+ */
+void SingleApplicationPrivate::recordAckLatency( qint64 usecs )
+{
+    if( ! ( options & SingleApplication::Mode::AdaptiveTimeouts ) || memory == nullptr || memory->data() == nullptr )
+        return;
+
+    int bucket = 0;
+    for( quint64 rest = usecs > 0 ? static_cast<quint64>( usecs ) : 0; rest != 0 && bucket < SingleApplication::Histogram::BucketCount - 1; rest >>= 1 )
+        ++bucket;
+
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    inst->ackLatency[bucket].fetch_add( 1, std::memory_order_relaxed );
+}
+
+/**
+ * @brief Publishes percentiles of the reported latencies and halves the
+ * counts, so that older samples fade out
+ */
+void SingleApplicationPrivate::publishAckLatency( InstancesInfo *inst )
+{
+    SingleApplication::Histogram histogram;
+    for( int i = 0; i < SingleApplication::Histogram::BucketCount; ++i ){
+        const quint32 value = inst->ackLatency[i].load( std::memory_order_relaxed );
+        inst->ackLatency[i].fetch_sub( value / 2, std::memory_order_relaxed );
+        histogram.buckets[i] = value;
+        histogram.count += value;
+        if( value > 0 )
+            histogram.max = static_cast<quint64>( 1 ) << i;
+    }
+
+    inst->ackLatencyP50.store( static_cast<qint32>( histogram.percentile( 50 ) ), std::memory_order_relaxed );
+    inst->ackLatencyP99.store( static_cast<qint32>( histogram.percentile( 99 ) ), std::memory_order_relaxed );
+}
+
+/**
+ * @brief Derives a timeout from the published 99th percentile latency
+ * @returns the given timeout without published latencies
+ */
+int SingleApplicationPrivate::adaptiveTimeout( int msecs ) const
+{
+    if( ! ( options & SingleApplication::Mode::AdaptiveTimeouts ) || memory == nullptr || memory->constData() == nullptr )
+        return msecs;
+
+    const auto *inst = static_cast<const InstancesInfo*>( memory->constData() );
+    const qint32 p99 = inst->ackLatencyP99.load( std::memory_order_relaxed );
+    if( p99 <= 0 )
+        return msecs;
+
+    // Only ever shortens the caller's deadline, an expired one stays expired
+    const int p99Msecs = ( p99 + 999 ) / 1000;
+    const int adaptive = qBound( static_cast<int>( AdaptiveTimeoutFloor ), p99Msecs * AdaptiveTimeoutFactor, static_cast<int>( AdaptiveTimeoutCap ) );
+    return msecs >= 0 ? qMin( adaptive, msecs ) : adaptive;
+}
+
+/**
+ * @brief Notifies a running primary instance and forwards a message to it
+ * without becoming an instance. Only attaches to an existing memory block.
+ * @returns `true` if the primary instance acknowledged
+ */
+bool SingleApplicationPrivate::forwardToPrimary( const QByteArray &message, SingleApplication::Options options, int msecs, const QString &userData )
+{
+    SingleApplicationPrivate d( nullptr );
+    d.options = options;
+    if( ! userData.isEmpty() )
+        d.addAppData( userData );
+    d.genBlockServerName();
+    d.beginConnectToPrimary();
+    const Deadline deadline( msecs );
+
+    d.memory = createMemoryBlock( d.blockServerName );
+
+    // Without a memory block there is no primary instance
+    if( ! d.memory->attach() )
+        return false;
+
+    if( d.memory->size() < static_cast<int>( sizeof( InstancesInfo ) ) || ! d.memory->lock() )
+        return false;
+
+    auto *inst = static_cast<InstancesInfo*>( d.memory->data() );
+    const bool primaryAvailable = d.blockChecksum() == inst->checksum &&
+                                  inst->primary &&
+                                  isProcessRunning( inst->primaryPid ) &&
+                                  ! heartbeatExpired( inst );
+
+    // Take an instance id so that forwarded messages remain distinguishable
+    if( primaryAvailable )
+        d.startSecondary();
+
+    if( ! d.memory->unlock() ){
+        qDebug() << "SingleApplication: Unable to unlock memory after forwarding check.";
+        qDebug() << d.memory->errorString();
+    }
+
+    if( ! primaryAvailable )
+        return false;
+
+    QByteArray payload = message;
+    quint8 flags = 0;
+    if( options & SingleApplication::Mode::CollapseLaunchStorms && ! message.isEmpty() ){
+        PendingMessage pending;
+        pending.instanceId = d.instanceNumber;
+        pending.topic = 0;
+        pending.flags = 0;
+        pending.message = message;
+
+        QByteArray batch;
+        switch( d.stageMessage( deadline, pending, batch ) ){
+        case StagingAppended:
+            return true;
+        case StagingFlush:
+            payload = batch;
+            flags = SingleApplicationCore::FlagBatch;
+            break;
+        case StagingUnavailable:
+            break;
+        }
+    }
+
+    if( options & SingleApplication::Mode::SequenceMessages && ! payload.isEmpty() ){
+        std::string sequence;
+        SingleApplicationCore::appendUInt32( sequence, d.takeSequence() );
+        payload.prepend( sequence.data(), static_cast<int>( sequence.size() ) );
+        flags |= SingleApplicationCore::FlagSequenced;
+    }
+
+    const Deadline exchangeDeadline( d.adaptiveTimeout( deadline.remaining() ) );
+    if( ! d.connectToPrimary( exchangeDeadline, NewInstance ) )
+        return false;
+
+    if( payload.isEmpty() )
+        return true;
+
+    return d.writeConfirmedMessage( exchangeDeadline, payload, SingleApplication::NonBlocking, 0, flags );
+}
+
+/**
+ * @brief Encodes the launch context of the current process
+ */
+QByteArray SingleApplicationPrivate::activationRecord( const QStringList &environmentNames )
+{
+    SingleApplicationCore::ActivationRecord record;
+    record.timestamp = QDateTime::currentMSecsSinceEpoch();
+    record.workingDirectory = QDir::currentPath().toUtf8().toStdString();
+
+    const QStringList args = QCoreApplication::arguments();
+    for( const QString &argument : args )
+        record.arguments.push_back( argument.toUtf8().toStdString() );
+
+    for( const QString &name : environmentNames ){
+        const QByteArray key = name.toLocal8Bit();
+        if( qEnvironmentVariableIsSet( key.constData() ) )
+            record.environment.emplace_back( name.toUtf8().toStdString(), QString::fromLocal8Bit( qgetenv( key.constData() ) ).toUtf8().toStdString() );
+    }
+
+    return QByteArray::fromStdString( SingleApplicationCore::encodeActivation( record ) );
+}
+
+qint64 SingleApplicationPrivate::forkFromPrimary( SingleApplication::Options options, int msecs, const QString &userData )
+{
+#ifdef Q_OS_UNIX
+    SingleApplicationPrivate d( nullptr );
+    d.options = options;
+    if( ! userData.isEmpty() )
+        d.addAppData( userData );
+    d.genBlockServerName();
+
+    const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    const QByteArray activation = activationRecord( SingleApplication::defaultActivationEnvironment() );
+    return SingleApplicationCore::requestFork( d.blockServerName.toStdString(), activation.toStdString(), fds, msecs );
+#else
+    Q_UNUSED( options );
+    Q_UNUSED( msecs );
+    Q_UNUSED( userData );
+    return -1;
+#endif
+}
+
+int SingleApplicationPrivate::zygoteControl = -1;
+
+/**
+ * @brief Starts the zygote and, in a new instance it forked, applies the
+ * launch context of the requester
+ */
+bool SingleApplicationPrivate::startZygote( int &argc, char **&argv )
+{
+#ifdef Q_OS_UNIX
+    SingleApplicationCore::ZygoteResult zygote = SingleApplicationCore::startZygote();
+    if( ! zygote.instance ){
+        if( zygote.control < 0 )
+            qWarning() << "SingleApplication: Unable to start the zygote.";
+        zygoteControl = zygote.control;
+        return false;
+    }
+
+    const SingleApplication::Activation activation( QByteArray::fromStdString( zygote.activation ) );
+    const QString workingDirectory = activation.workingDirectory();
+    if( ! workingDirectory.isEmpty() )
+        QDir::setCurrent( workingDirectory );
+
+    // Loader variables and the like are not taken from the requester
+    const QStringList allowed = SingleApplication::defaultActivationEnvironment();
+    const QMap<QString, QString> environment = activation.environment();
+    for( auto it = environment.constBegin(); it != environment.constEnd(); ++it ){
+        if( allowed.contains( it.key() ) )
+            qputenv( it.key().toLocal8Bit().constData(), it.value().toLocal8Bit() );
+    }
+
+    // QCoreApplication keeps referring to argv, so it lives as long as the process
+    static QList<QByteArray> arguments;
+    static std::vector<char*> pointers;
+    const QStringList requested = activation.arguments();
+    if( ! requested.isEmpty() ){
+        for( const QString &argument : requested )
+            arguments.append( argument.toLocal8Bit() );
+        for( QByteArray &argument : arguments )
+            pointers.push_back( argument.data() );
+        pointers.push_back( nullptr );
+        argc = static_cast<int>( arguments.size() );
+        argv = pointers.data();
+    }
+    return true;
+#else
+    Q_UNUSED( argc );
+    Q_UNUSED( argv );
+    return false;
+#endif
+}
+
+/**
+ * @brief Makes the zygote listen for fork requests next to the local server
+ */
+void SingleApplicationPrivate::startForkServer()
+{
+#ifdef Q_OS_UNIX
+    if( zygoteControl < 0 ){
+        qWarning() << "SingleApplication: No zygote to serve fork requests, see SingleApplication::startZygote().";
+        return;
+    }
+
+    if( ! SingleApplicationCore::serveForkRequests( zygoteControl, blockServerName.toStdString() ) ){
+        qWarning() << "SingleApplication: Unable to listen for fork requests.";
+        stopForkServer();
+    }
+#else
+    qWarning() << "SingleApplication: Mode::ForkServer is only supported on Unix.";
+#endif
+}
+
+/**
+ * @brief Lets the zygote exit, it removes its socket unless another instance
+ * replaced it
+ */
+void SingleApplicationPrivate::stopForkServer()
+{
+#ifdef Q_OS_UNIX
+    if( zygoteControl < 0 ) return;
+    ::close( zygoteControl );
+    zygoteControl = -1;
+#endif
+}
+
+bool SingleApplicationPrivate::isProcessRunning( qint64 pid )
+{
+    if ( pid <= 0 )
+        return false;
+
+#ifdef Q_OS_UNIX
+    return kill( static_cast<pid_t>( pid ), 0 ) == 0 || errno != ESRCH;
+#endif
+#ifdef Q_OS_WIN
+    HANDLE hProcess = OpenProcess( PROCESS_QUERY_LIMITED_INFORMATION, FALSE, static_cast<DWORD>( pid ) );
+    if ( hProcess == NULL )
+        return false;
+    DWORD exitCode;
+    bool running = GetExitCodeProcess( hProcess, &exitCode ) && exitCode == STILL_ACTIVE;
+    CloseHandle( hProcess );
+    return running;
+#endif
+}
+
+/**
+ * @brief Whether the current instance may take the primary role without
+ * asking the recorded primary instance. Expects the memory block to be locked.
+ */
+bool SingleApplicationPrivate::isPrimaryRoleVacant( const InstancesInfo *inst ) const
+{
+    return ! inst->primary || ! isProcessRunning( inst->primaryPid ) ||
+           inst->primaryPid == QCoreApplication::applicationPid() ||
+           ( options & SingleApplication::Mode::TakeOverUnresponsivePrimary && heartbeatExpired( inst ) );
+}
+
+/**
+ * @brief Takes over the primary role if it is vacant, otherwise makes sure the
+ * socket is registered with the current primary instance as a standby
+ * connection, whose disconnection signals that the primary instance exited
+ * @returns `true` if this instance is the primary instance
+ */
+bool SingleApplicationPrivate::claimPrimaryRole( int msecs )
+{
+    Q_Q( SingleApplication );
+
+    if( server != nullptr ) return true;
+
+    if( ! memory->lock() ){
+        qDebug() << "SingleApplication: Unable to lock memory to claim the primary role.";
+        return false;
+    }
+
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    bool vacant = isPrimaryRoleVacant( inst );
+    const qint64 probedPid = inst->primaryPid;
+
+    if( ! memory->unlock() ){
+        qDebug() << "SingleApplication: Unable to unlock memory before probing the primary instance.";
+        qDebug() << memory->errorString();
+    }
+
+    // Probing may take up to StandbyConnectTimeout, so it happens without the
+    // lock and is validated against the block afterwards
+    bool probed = false;
+    bool connected = false;
+    if( ! vacant && ( socket == nullptr || socket->state() != QLocalSocket::ConnectedState || ! standby ) ){
+        if( socket == nullptr ){
+            socket = new QLocalSocket();
+        }
+        socket->abort();
+        pendingHandshake = false;
+        standby = false;
+
+        socket->connectToServer( blockServerName );
+        connected = socket->waitForConnected( qBound( 0, msecs, static_cast<int>( StandbyConnectTimeout ) ) );
+        probed = true;
+    }
+
+    if( ! memory->lock() ){
+        qDebug() << "SingleApplication: Unable to lock memory to claim the primary role.";
+        return false;
+    }
+
+    // A handover the previous primary instance rolled back, because it did
+    // not see the acknowledgement in time, has been spooled instead
+    if( handoverReceived && inst->primaryPid != QCoreApplication::applicationPid() ){
+        handoverReceived = false;
+        pendingMessages.clear();
+    }
+
+    vacant = isPrimaryRoleVacant( inst );
+    bool registerStandby = false;
+    if( ! vacant && probed ){
+        if( inst->primaryPid == probedPid ){
+            // The primary instance starts listening before it releases the lock, so
+            // a refused connection means it is gone even if its PID is still taken.
+            // Right after a handover the successor needs a moment to start listening.
+            const bool handingOver = monotonicMSecs() - inst->primaryHeartbeat < HandoverTimeout;
+            vacant = ! connected && ! handingOver;
+            registerStandby = connected;
+        } else {
+            // Another instance took the role while probing, registering with
+            // it is left to the next attempt
+            socket->abort();
+        }
+    }
+
+    if( vacant ){
+        if( socket != nullptr ){
+            // May be called from one of the socket's signals
+            socket->abort();
+            socket->deleteLater();
+            socket = nullptr;
+        }
+        standby = false;
+        startPrimary();
+    }
+
+    if( ! memory->unlock() ){
+        qDebug() << "SingleApplication: Unable to unlock memory after claiming the primary role.";
+        qDebug() << memory->errorString();
+    }
+
+    if( vacant ){
+        handoverReceived = false;
+        // Messages forwarded by the previous primary instance are delivered
+        // once the event loop runs, so that receivers can be connected first
+        if( ! pendingMessages.isEmpty() )
+            QTimer::singleShot( 0, this, &SingleApplicationPrivate::slotDeliverPendingMessages );
+        Q_EMIT q->primaryRoleAcquired();
+        return true;
+    }
+
+    if( registerStandby ){
+        standby = writeInitMessage( Deadline( qMax( msecs, static_cast<int>( StandbyConnectTimeout ) ) ), StandbyInstance );
+        QObject::connect(
+            socket,
+            &QLocalSocket::readyRead,
+            this,
+            &SingleApplicationPrivate::slotStandbyReadyRead,
+            Qt::UniqueConnection
+        );
+        if( watchPrimaryRole ){
+            QObject::connect(
+                socket,
+                &QLocalSocket::disconnected,
+                this,
+                &SingleApplicationPrivate::slotPrimaryDisconnected,
+                static_cast<Qt::ConnectionType>( Qt::QueuedConnection | Qt::UniqueConnection )
+            );
+        }
+    }
+
+    return false;
+}
+
+bool SingleApplicationPrivate::waitForPrimaryRole( int msecs )
+{
+    QElapsedTimer time;
+    time.start();
+
+    while( true ){
+        const int remaining = msecs < 0 ? -1 : static_cast<int>( msecs - time.elapsed() );
+
+        if( claimPrimaryRole( remaining < 0 ? static_cast<int>( StandbyConnectTimeout ) : remaining ) )
+            return true;
+
+        // Wakes up as soon as the primary instance hands over its role,
+        // closes the connection or dies
+        while( standby && socket->state() == QLocalSocket::ConnectedState && ! readHandover() ){
+            if( msecs >= 0 && time.elapsed() >= msecs )
+                return false;
+            socket->waitForReadyRead( msecs < 0 ? -1 : static_cast<int>( msecs - time.elapsed() ) );
+        }
+
+        // A handed over role must be claimed regardless of the timeout
+        if( ! handoverReceived && msecs >= 0 && time.elapsed() >= msecs )
+            return false;
+
+        if( ! standby && ! handoverReceived )
+            randomSleep();
+    }
+}
+
+void SingleApplicationPrivate::startWatchingPrimaryRole()
+{
+    watchPrimaryRole = true;
+    slotPrimaryDisconnected();
+}
+
+/**
+ * @brief Executed on a standby instance when the primary instance sent data
+ */
+void SingleApplicationPrivate::slotStandbyReadyRead()
+{
+    if( watchPrimaryRole && standby && server == nullptr && readHandover() )
+        slotPrimaryDisconnected();
+}
+
+/**
+ * @brief Reads the handover frame the primary instance sends to its designated
+ * standby before it exits
+ * @returns `true` if a complete handover frame was read and acknowledged
+ */
+bool SingleApplicationPrivate::readHandover()
+{
+    const qint64 prefixLen = sizeof( quint8 ) + sizeof( quint64 );
+    if( socket->bytesAvailable() < prefixLen )
+        return false;
+
+    QByteArray prefix = socket->peek( prefixLen );
+    QDataStream prefixStream( prefix );
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
+    prefixStream.setVersion( QDataStream::Qt_5_6 );
+#endif
+    quint8 marker = 0;
+    quint64 payloadLen = 0;
+    prefixStream >> marker;
+    prefixStream >> payloadLen;
+
+    if( marker != HandoverMarker || socket->bytesAvailable() < prefixLen + static_cast<qint64>( payloadLen ) )
+        return false;
+
+    socket->read( prefixLen );
+    const QByteArray payload = socket->read( static_cast<qint64>( payloadLen ) );
+    QDataStream readStream( payload );
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
+    readStream.setVersion( QDataStream::Qt_5_6 );
+#endif
+
+    QByteArray state;
+    quint32 count = 0;
+    readStream >> state;
+    readStream >> count;
+
+    QList<PendingMessage> messages;
+    for( quint32 i = 0; i < count && readStream.status() == QDataStream::Ok; ++i ){
+        PendingMessage pending;
+        readStream >> pending.instanceId;
+        readStream >> pending.topic;
+        readStream >> pending.flags;
+        readStream >> pending.message;
+        messages.append( pending );
+    }
+
+    if( readStream.status() != QDataStream::Ok ){
+        qWarning() << "SingleApplication: Received a corrupt handover from the primary instance.";
+        return false;
+    }
+
+    handoverData = state;
+    pendingMessages.append( messages );
+    handoverReceived = true;
+
+    // Once acknowledged the role belongs to this instance
+    writeAck( socket );
+    socket->waitForBytesWritten( HandoverTimeout );
+
+    return true;
+}
+
+/**
+ * @brief Reads all complete frames buffered on client connections without
+ * delivering them, so that they can be forwarded on handover
+ * @note The frames are acknowledged, so they must reach the successor or the spool
+ */
+void SingleApplicationPrivate::drainConnections( QLocalSocket *successor )
+{
+    const QList<QLocalSocket*> sockets = connectionMap.keys();
+    for( QLocalSocket *sock : sockets ){
+        if( sock == successor ) continue;
+
+        if( connectionMap[sock].stage == StageConnectedHeader )
+            readMessageHeader( sock, StageConnectedBody );
+
+        ConnectionInfo &info = connectionMap[sock];
+        if( info.stage != StageConnectedBody || ! isFrameComplete( sock ) )
+            continue;
+
+        PendingMessage pending;
+        pending.instanceId = info.instanceId;
+        pending.topic = info.topic;
+        pending.flags = info.flags;
+        pending.message = sock->read( info.msgLen );
+        info.stage = StageConnectedHeader;
+        pendingMessages.append( pending );
+
+        stats.messagesReceived.fetch_add( 1, std::memory_order_relaxed );
+        stats.bytesReceived.fetch_add( static_cast<quint64>( pending.message.size() ), std::memory_order_relaxed );
+
+        writeAck( sock );
+        sock->flush();
+    }
+}
+
+/**
+ * @brief Hands the primary role over to a standby instance together with
+ * messages that have not been delivered yet and the application state set
+ * with `SingleApplication::setHandoverData()`. The memory block is only locked
+ * to update it, not while waiting for the standby instance.
+ * @returns `true` if a standby instance accepted the role
+ */
+bool SingleApplicationPrivate::handOverPrimaryRole()
+{
+    QLocalSocket *successor = nullptr;
+    qint64 successorPid = 0;
+
+    // A standby instance that is in the middle of a frame would swallow the
+    // handover, so it is ruled out before anything is drained
+    for( auto it = connectionMap.constBegin(); it != connectionMap.constEnd(); ++it ){
+        if( it.value().connectionType == StandbyInstance &&
+            it.value().stage == StageConnectedHeader &&
+            it.key()->bytesAvailable() == 0 &&
+            it.key()->state() == QLocalSocket::ConnectedState &&
+            isProcessRunning( it.value().pid ) )
+        {
+            successor = it.key();
+            successorPid = it.value().pid;
+            break;
+        }
+    }
+
+    if( successor == nullptr )
+        return false;
+
+    // Messages held back by coalescing arrived before anything still buffered
+    for( const SingleApplication::Message &message : coalescingBuffer ){
+        PendingMessage pending;
+        pending.instanceId = message.instanceId;
+        pending.topic = 0;
+        pending.flags = 0;
+        pending.message = message.data;
+        pendingMessages.append( pending );
+    }
+    coalescingBuffer.clear();
+
+    // Messages waiting for a missing sequence number keep their stamp
+    pendingMessages.append( reorderBuffer );
+    reorderBuffer.clear();
+
+    drainConnections( successor );
+
+    QByteArray payload;
+    QDataStream payloadStream( &payload, QIODevice::WriteOnly );
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
+    payloadStream.setVersion( QDataStream::Qt_5_6 );
+#endif
+    payloadStream << handoverData;
+    payloadStream << static_cast<quint32>( pendingMessages.size() );
+    const QList<PendingMessage> &messages = pendingMessages;
+    for( const PendingMessage &pending : messages ){
+        payloadStream << pending.instanceId;
+        payloadStream << pending.topic;
+        payloadStream << pending.flags;
+        payloadStream << pending.message;
+    }
+
+    QByteArray frame;
+    QDataStream frameStream( &frame, QIODevice::WriteOnly );
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 6, 0))
+    frameStream.setVersion( QDataStream::Qt_5_6 );
+#endif
+    frameStream << static_cast<quint8>( HandoverMarker );
+    frameStream << static_cast<quint64>( payload.size() );
+    frame.append( payload );
+
+    // The successor is recorded before it receives the frame, so it finds
+    // itself in the block when it claims the role however late it answers.
+    // The role passes to it without ever becoming vacant, and the fresh
+    // heartbeat covers the time until it starts listening.
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    if( ! lockMemory() ){
+        spoolPendingMessages();
+        return false;
+    }
+    const bool owner = inst->primaryPid == QCoreApplication::applicationPid();
+    const qint64 committedHeartbeat = monotonicMSecs();
+    if( owner ){
+        inst->primaryPid = successorPid;
+        inst->primaryHeartbeat = committedHeartbeat;
+        inst->checksum = blockChecksum();
+    }
+    memory->unlock();
+    if( ! owner ){
+        spoolPendingMessages();
+        return false;
+    }
+
+    // Anything the standby sent earlier is not its acknowledgement
+    successor->readAll();
+    successor->write( frame );
+    successor->flush();
+
+    if( successor->waitForReadyRead( HandoverTimeout ) && successor->read( 1 ) == QByteArray( 1, '\n' ) ){
+        pendingMessages.clear();
+        return true;
+    }
+
+    qWarning() << "SingleApplication: Standby instance did not accept the primary role.";
+
+    // Roll back, unless the successor already claimed the role, which renews
+    // the heartbeat. A successor that reads the frame later finds another
+    // instance in the block and drops the handed over messages.
+    bool claimed = false;
+    if( lockMemory() ){
+        if( inst->primaryPid == successorPid ){
+            claimed = inst->primaryHeartbeat != committedHeartbeat;
+            if( ! claimed ){
+                inst->primary = false;
+                inst->primaryPid = -1;
+                inst->primaryUser[0] =  '\0';
+                inst->primaryHeartbeat = 0;
+                inst->checksum = blockChecksum();
+            }
+        }
+        memory->unlock();
+    }
+
+    if( claimed ){
+        pendingMessages.clear();
+        return true;
+    }
+
+    spoolPendingMessages();
+    return false;
+}
+
+/**
+ * @brief Writes messages that were acknowledged but could not be handed over
+ * to the spool, where the next primary instance picks them up
+ */
+void SingleApplicationPrivate::spoolPendingMessages()
+{
+    const QList<PendingMessage> &messages = pendingMessages;
+    for( const PendingMessage &pending : messages ){
+        if( ! spoolMessage( pending ) )
+            qWarning() << "SingleApplication: Unable to spool a message that was not handed over.";
+    }
+    pendingMessages.clear();
+}
+
+/**
+ * @brief Emits messages forwarded by the previous primary instance
+ */
+void SingleApplicationPrivate::slotDeliverPendingMessages()
+{
+    // A receiver may make the instance not ready again
+    while( ready && ! pendingMessages.isEmpty() )
+        deliverMessage( pendingMessages.takeFirst() );
+}
+
+/**
+ * @brief Delivers a message and emits the messages nobody handled as one group
+ */
+void SingleApplicationPrivate::deliverMessage( const PendingMessage &message )
+{
+    QList<SingleApplication::Message> unhandled;
+    dispatchMessage( message, unhandled );
+    if( ! unhandled.isEmpty() )
+        emitReceivedMessages( unhandled );
+}
+
+/**
+ * @brief Unpacks batches, emits activations through `activationReceived()`
+ * and dispatches other messages to the handler of their topic. Messages
+ * without a handler are collected in `unhandled`.
+ */
+void SingleApplicationPrivate::dispatchMessage( const PendingMessage &message, QList<SingleApplication::Message> &unhandled )
+{
+    Q_Q( SingleApplication );
+
+    if( message.flags & SingleApplicationCore::FlagSequenced ){
+        if( message.message.size() < 4 ){
+            qWarning() << "SingleApplication: Received a truncated sequenced message from instance" << message.instanceId;
+            return;
+        }
+        PendingMessage unstamped = message;
+        unstamped.flags &= ~SingleApplicationCore::FlagSequenced;
+        unstamped.message = message.message.mid( 4 );
+        dispatchMessage( unstamped, unhandled );
+        return;
+    }
+
+    if( message.flags & SingleApplicationCore::FlagBatch ){
+        std::vector<SingleApplicationCore::BatchItem> items;
+        if( ! SingleApplicationCore::decodeBatch( message.message.constData(), static_cast<std::size_t>( message.message.size() ), items ) ){
+            qWarning() << "SingleApplication: Received a corrupt batch from instance" << message.instanceId;
+            return;
+        }
+        for( const SingleApplicationCore::BatchItem &item : items ){
+            PendingMessage unpacked;
+            unpacked.instanceId = item.instanceId;
+            unpacked.topic = item.topic;
+            unpacked.flags = item.flags;
+            unpacked.message = QByteArray::fromStdString( item.payload );
+            dispatchMessage( unpacked, unhandled );
+        }
+        return;
+    }
+
+    if( message.flags & SingleApplicationCore::FlagActivation ){
+        Q_EMIT q->activationReceived( message.instanceId, SingleApplication::Activation( message.message ) );
+        return;
+    }
+
+    if( message.topic != 0 ){
+        const auto handler = handlers.constFind( message.topic );
+        if( handler != handlers.constEnd() ){
+            // Copied, the handler may unregister itself
+            const SingleApplication::MessageHandler invoke = handler.value();
+            invoke( message.instanceId, message.message );
+            return;
+        }
+    }
+
+    SingleApplication::Message received;
+    received.instanceId = message.instanceId;
+    received.data = message.message;
+    unhandled.append( received );
+}
+
+/**
+ * @brief Emits `receivedMessage()` for each message and `receivedMessages()`
+ * for the group, or holds them back while a coalescing window is configured
+ */
+void SingleApplicationPrivate::emitReceivedMessages( const QList<SingleApplication::Message> &messages )
+{
+    Q_Q( SingleApplication );
+
+    if( coalescingTimer != nullptr && coalescingTimer->interval() > 0 ){
+        coalescingBuffer.append( messages );
+        // The window opens with the first message of a burst and does not slide
+        if( ! coalescingTimer->isActive() )
+            coalescingTimer->start();
+        return;
+    }
+
+    for( const SingleApplication::Message &message : messages )
+        Q_EMIT q->receivedMessage( message.instanceId, message.data );
+    Q_EMIT q->receivedMessages( messages );
+}
+
+void SingleApplicationPrivate::setOrderingWindow( int msecs )
+{
+    if( orderingTimer == nullptr ){
+        orderingTimer = new QTimer( this );
+        orderingTimer->setSingleShot( true );
+        QObject::connect(
+            orderingTimer,
+            &QTimer::timeout,
+            this,
+            &SingleApplicationPrivate::slotOrderingTimeout
+        );
+    }
+
+    orderingTimer->setInterval( qMax( msecs, 0 ) );
+
+    // Messages held back are released when reordering is disabled
+    if( msecs <= 0 ){
+        orderingTimer->stop();
+        while( ! reorderBuffer.isEmpty() )
+            releaseOrderedMessages( true );
+    }
+}
+
+/**
+ * @brief Takes the next number from the sequence counter in the memory block
+ */
+quint32 SingleApplicationPrivate::takeSequence()
+{
+    auto *inst = static_cast<InstancesInfo*>( memory->data() );
+    return inst->sequence.fetch_add( 1 ) + 1;
+}
+
+quint32 SingleApplicationPrivate::messageSequence( const PendingMessage &message )
+{
+    SingleApplicationCore::Reader reader( message.message.constData(), static_cast<std::size_t>( message.message.size() ) );
+    std::uint32_t sequence = 0;
+    reader.readUInt32( sequence );
+    return sequence;
+}
+
+/**
+ * @brief Holds a sequenced message back until the messages sent before it
+ * arrived or the ordering window passed
+ */
+void SingleApplicationPrivate::orderMessage( const PendingMessage &message )
+{
+    if( orderingTimer == nullptr || orderingTimer->interval() == 0 ||
+        ! ( message.flags & SingleApplicationCore::FlagSequenced ) || message.message.size() < 4 )
+    {
+        queueMessage( message );
+        return;
+    }
+
+    // Sequence numbers wrap around, so they are compared by their distance
+    const quint32 sequence = messageSequence( message );
+    int i = reorderBuffer.size();
+    while( i > 0 && static_cast<qint32>( messageSequence( reorderBuffer.at( i - 1 ) ) - sequence ) > 0 )
+        --i;
+    reorderBuffer.insert( i, message );
+
+    releaseOrderedMessages( reorderBuffer.size() > MaximumReorderedMessages );
+}
+
+/**
+ * @brief Delivers buffered messages up to the next missing sequence number
+ * @param skipGap - give up waiting for the first missing sequence number
+ */
+void SingleApplicationPrivate::releaseOrderedMessages( bool skipGap )
+{
+    while( ! reorderBuffer.isEmpty() ){
+        const quint32 sequence = messageSequence( reorderBuffer.first() );
+        const qint32 distance = static_cast<qint32>( sequence - nextSequence );
+        if( distance > 0 && ! skipGap )
+            break;
+
+        skipGap = false;
+        // A message arriving after its successors were released is late
+        if( distance >= 0 )
+            nextSequence = sequence + 1;
+        queueMessage( reorderBuffer.takeFirst() );
+    }
+
+    if( reorderBuffer.isEmpty() )
+        orderingTimer->stop();
+    else if( ! orderingTimer->isActive() )
+        orderingTimer->start();
+}
+
+/**
+ * @brief Executed when a message waited the whole ordering window
+ */
+void SingleApplicationPrivate::slotOrderingTimeout()
+{
+    releaseOrderedMessages( true );
+}
+
+/**
+ * @brief Switches between holding messages back and delivering them
+ */
+void SingleApplicationPrivate::setReady( bool ready )
+{
+    Q_Q( SingleApplication );
+
+    if( this->ready == ready )
+        return;
+
+    this->ready = ready;
+    if( ! ready )
+        return;
+
+    for( ; deferredInstanceStarts > 0; --deferredInstanceStarts )
+        Q_EMIT q->instanceStarted();
+
+    slotDeliverPendingMessages();
+
+    // Resume connections whose frames were left unread while the queue was full
+    const QList<QLocalSocket*> sockets = connectionMap.keys();
+    for( QLocalSocket *sock : sockets ){
+        if( connectionMap.contains( sock ) && sock->bytesAvailable() > 0 )
+            readConnection( sock );
+    }
+}
+
+void SingleApplicationPrivate::setCoalescingWindow( int msecs, const SingleApplication::CoalescingKeyFunction &keyFunction )
+{
+    if( coalescingTimer == nullptr ){
+        coalescingTimer = new QTimer( this );
+        coalescingTimer->setSingleShot( true );
+        QObject::connect(
+            coalescingTimer,
+            &QTimer::timeout,
+            this,
+            &SingleApplicationPrivate::slotCoalescingTimeout
+        );
+    }
+
+    coalescingKey = keyFunction;
+    coalescingTimer->setInterval( qMax( msecs, 0 ) );
+
+    // Messages held back are released when coalescing is disabled
+    if( msecs <= 0 ){
+        coalescingTimer->stop();
+        slotCoalescingTimeout();
+    }
+}
+
+/**
+ * @brief Executed when a coalescing window closes, emits the messages held
+ * back without duplicates
+ */
+void SingleApplicationPrivate::slotCoalescingTimeout()
+{
+    Q_Q( SingleApplication );
+
+    if( coalescingBuffer.isEmpty() )
+        return;
+
+    const QList<SingleApplication::Message> buffered = coalescingBuffer;
+    coalescingBuffer.clear();
+
+    QList<SingleApplication::Message> messages;
+    QSet<QByteArray> seen;
+    for( const SingleApplication::Message &message : buffered ){
+        const QByteArray key = coalescingKey ? coalescingKey( message.data ) : message.data;
+        if( ! key.isEmpty() ){
+            if( seen.contains( key ) )
+                continue;
+            seen.insert( key );
+        }
+        messages.append( message );
+    }
+
+    for( const SingleApplication::Message &message : messages )
+        Q_EMIT q->receivedMessage( message.instanceId, message.data );
+    Q_EMIT q->receivedMessages( messages );
+}
+
+/**
+ * @brief Executed on a standby instance when its connection to the primary
+ * instance is lost
+ */
+void SingleApplicationPrivate::slotPrimaryDisconnected()
+{
+    if( ! watchPrimaryRole || claimPrimaryRole( StandbyConnectTimeout ) ){
+        watchPrimaryRole = false;
+        return;
+    }
+
+    // Registration failed without the role becoming vacant, try again later
+    if( ! standby ){
+        QTimer::singleShot( static_cast<int>( StandbyConnectTimeout ), this, &SingleApplicationPrivate::slotPrimaryDisconnected );
+    }
+}
+
+/**
+ * @brief Executed when a connection has been made to the LocalServer
+ */
+void SingleApplicationPrivate::slotConnectionEstablished()
+{
+    QLocalSocket *nextConnSocket = server->nextPendingConnection();
+    if( nextConnSocket == nullptr )
+        return;
+    ++acceptedConnections;
+
+    ConnectionInfo connectionInfo;
+    if( userConnections.isEnabled() || userMessages.isEnabled() )
+        connectionInfo.userId = peerUserId( nextConnSocket );
+    connectionMap.insert(nextConnSocket, connectionInfo);
+    if( pollDescriptor >= 0 )
+        watchDescriptor( nextConnSocket->socketDescriptor() );
+    stats.connectionCount.store( static_cast<int>( connectionMap.size() ), std::memory_order_relaxed );
+
+    QObject::connect(nextConnSocket, &QLocalSocket::aboutToClose, this,
+        [nextConnSocket, this](){
+            auto &info = connectionMap[nextConnSocket];
+            this->slotClientConnectionClosed( nextConnSocket, info.instanceId );
+        }
+    );
+
+    QObject::connect(nextConnSocket, &QLocalSocket::disconnected, nextConnSocket, &QLocalSocket::deleteLater);
+
+    QObject::connect(nextConnSocket, &QLocalSocket::destroyed, this,
+        [nextConnSocket, this](){
+            if( connectionMap.value( nextConnSocket ).scheduled ){
+                interactiveLane.removeOne( nextConnSocket );
+                bulkLane.removeOne( nextConnSocket );
+            }
+            connectionMap.remove(nextConnSocket);
+            stats.connectionCount.store( static_cast<int>( connectionMap.size() ), std::memory_order_relaxed );
+        }
+    );
+
+    QObject::connect(nextConnSocket, &QLocalSocket::readyRead, this,
+        [nextConnSocket, this](){
+            if( schedulerTimer != nullptr )
+                scheduleConnection( nextConnSocket );
+            else
+                readConnection( nextConnSocket );
+        }
+    );
+}
+
+void SingleApplicationPrivate::setSchedulingBudget( int msecs, qint64 bytes )
+{
+    schedulingTimeBudget = qMax( msecs, 0 );
+    schedulingByteBudget = qMax<qint64>( bytes, 0 );
+
+    if( schedulingTimeBudget > 0 || schedulingByteBudget > 0 ){
+        if( schedulerTimer == nullptr ){
+            schedulerTimer = new QTimer( this );
+            schedulerTimer->setSingleShot( true );
+            schedulerTimer->setInterval( 0 );
+            QObject::connect(
+                schedulerTimer,
+                &QTimer::timeout,
+                this,
+                &SingleApplicationPrivate::slotProcessConnections
+            );
+        }
+        return;
+    }
+
+    // Without a budget connections are read as data arrives again
+    if( schedulerTimer != nullptr ){
+        delete schedulerTimer;
+        schedulerTimer = nullptr;
+        slotProcessConnections();
+    }
+}
 
-    // server name
-    QByteArray latin1Name;
-    readStream >> latin1Name;
+qintptr SingleApplicationPrivate::nativeDescriptor()
+{
+#if defined(Q_OS_LINUX) && QT_VERSION >= QT_VERSION_CHECK( 5, 10, 0 )
+    if( server == nullptr )
+        return -1;
+
+    if( pollDescriptor < 0 ){
+        pollDescriptor = epoll_create1( EPOLL_CLOEXEC );
+        if( pollDescriptor < 0 ){
+            qWarning() << "SingleApplication: Unable to create a poll descriptor.";
+            return -1;
+        }
 
-    // connection type
-    ConnectionType connectionType = InvalidConnection;
-    quint8 connTypeVal = InvalidConnection;
-    readStream >> connTypeVal;
-    connectionType = static_cast <ConnectionType>( connTypeVal );
+        // Closed descriptors leave the epoll set by themselves
+        watchDescriptor( server->socketDescriptor() );
+        for( auto it = connectionMap.constBegin(); it != connectionMap.constEnd(); ++it )
+            watchDescriptor( it.key()->socketDescriptor() );
+    }
 
-    // instance id
-    quint32 instanceId = 0;
-    readStream >> instanceId;
+    return pollDescriptor;
+#else
+    return -1;
+#endif
+}
 
-    // checksum
-    quint16 msgChecksum = 0;
-    readStream >> msgChecksum;
+void SingleApplicationPrivate::watchDescriptor( qintptr descriptor )
+{
+#ifdef Q_OS_LINUX
+    if( descriptor < 0 )
+        return;
 
-#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
-    const quint16 actualChecksum = qChecksum(QByteArray(msgBytes.constData(), static_cast<quint32>(msgBytes.length() - sizeof(quint16))));
+    struct epoll_event event;
+    std::memset( &event, 0, sizeof( event ) );
+    event.events = EPOLLIN;
+    event.data.fd = static_cast<int>( descriptor );
+    epoll_ctl( pollDescriptor, EPOLL_CTL_ADD, static_cast<int>( descriptor ), &event );
 #else
-    const quint16 actualChecksum = qChecksum(msgBytes.constData(), static_cast<quint32>(msgBytes.length() - sizeof(quint16)));
+    Q_UNUSED( descriptor )
 #endif
+}
+
+/**
+ * @brief Checks whether a timer would have fired by now and rearms it, for
+ * callers that do not run Qt's event loop
+ */
+bool SingleApplicationPrivate::timerDue( QTimer *timer )
+{
+    if( timer == nullptr || ! timer->isActive() || timer->remainingTime() != 0 )
+        return false;
+
+    if( timer->isSingleShot() )
+        timer->stop();
+    else
+        timer->start();
+    return true;
+}
+
+/**
+ * @brief Drives the primary instance the way Qt's event loop would: accepts
+ * connections, reads every connection with data and fires due timers
+ */
+bool SingleApplicationPrivate::processEvents( int msecs )
+{
+    if( server == nullptr )
+        return false;
+
+    QElapsedTimer time;
+    time.start();
+    const auto budgetLeft = [&time, msecs](){ return msecs <= 0 || time.elapsed() < msecs; };
+
+    // Accepts a single connection per call and emits newConnection() for it.
+    // Its return value only tells whether accepted connections are still
+    // pending, which slotConnectionEstablished() already took. Polling stops
+    // once a call accepts nothing: none is waiting, accepting failed or the
+    // server is not listening.
+    while( budgetLeft() ){
+        const quint64 accepted = acceptedConnections;
+        server->waitForNewConnection( 0 );
+        if( acceptedConnections == accepted )
+            break;
+    }
+
+    // Emits readyRead(), or disconnected() for closed connections
+    const QList<QLocalSocket*> sockets = connectionMap.keys();
+    for( QLocalSocket *sock : sockets ){
+        if( ! budgetLeft() )
+            break;
+        if( ! connectionMap.contains( sock ) )
+            continue;
+        if( ! sock->waitForReadyRead( 0 ) && connectionMap.contains( sock ) && sock->bytesAvailable() > 0 ){
+            // Data left behind by a budget or a rate limit
+            if( schedulerTimer != nullptr )
+                scheduleConnection( sock );
+            else
+                readConnection( sock );
+        }
+    }
+
+    if( timerDue( schedulerTimer ) ) slotProcessConnections();
+    if( timerDue( heartbeatTimer ) ) slotHeartbeat();
+    if( timerDue( statsTimer ) ) slotStatsTimeout();
+    if( timerDue( valuesTimer ) ) slotSharedValuesTimeout();
+    if( timerDue( coalescingTimer ) ) slotCoalescingTimeout();
+    if( timerDue( orderingTimer ) ) slotOrderingTimeout();
+    slotDeliverPendingMessages();
+
+    // Acknowledgements are only written out by the event loop otherwise
+    for( auto it = connectionMap.constBegin(); it != connectionMap.constEnd(); ++it )
+        it.key()->flush();
+
+    // Closed connections were scheduled for deletion
+    QCoreApplication::sendPostedEvents( nullptr, QEvent::DeferredDelete );
+
+    return ! budgetLeft() || ! interactiveLane.isEmpty() || ! bulkLane.isEmpty();
+}
+
+/**
+ * @brief Queues a connection with buffered data in its lane
+ */
+void SingleApplicationPrivate::scheduleConnection( QLocalSocket *sock )
+{
+    ConnectionInfo &info = connectionMap[sock];
+    if( info.scheduled )
+        return;
+
+    info.scheduled = true;
+    if( info.stage == StageConnectedBody &&
+        info.msgLen > SingleApplication::BulkMessageSize &&
+        ! ( info.flags & SingleApplicationCore::FlagActivation ) )
+    {
+        bulkLane.append( sock );
+    } else {
+        interactiveLane.append( sock );
+    }
+
+    if( schedulerTimer != nullptr && ! schedulerTimer->isActive() )
+        schedulerTimer->start();
+}
+
+/**
+ * @brief Serves queued connections round-robin, a frame at a time, until the
+ * budget of the event loop iteration is used up
+ */
+void SingleApplicationPrivate::slotProcessConnections()
+{
+    QElapsedTimer time;
+    time.start();
+    qint64 bytes = 0;
+    bool bulkServed = false;
+
+    while( true ){
+        const bool overBudget = ( schedulingTimeBudget > 0 && time.elapsed() >= schedulingTimeBudget ) ||
+                                ( schedulingByteBudget > 0 && bytes >= schedulingByteBudget );
+
+        // Large messages get at least one turn per iteration
+        QList<QLocalSocket*> *lane = nullptr;
+        if( ! overBudget && ! interactiveLane.isEmpty() )
+            lane = &interactiveLane;
+        else if( ! bulkLane.isEmpty() && ( ! overBudget || ! bulkServed ) )
+            lane = &bulkLane;
+        else
+            break;
+
+        bulkServed = bulkServed || lane == &bulkLane;
+        QLocalSocket *sock = lane->takeFirst();
+        connectionMap[sock].scheduled = false;
+
+        const qint64 available = sock->bytesAvailable();
+        const quint8 stage = connectionMap[sock].stage;
+        readConnection( sock );
+        if( ! connectionMap.contains( sock ) )
+            continue;
+        bytes += available - sock->bytesAvailable();
+
+        // A connection with more frames buffered goes to the back of its lane
+        if( sock->bytesAvailable() > 0 &&
+            ( sock->bytesAvailable() != available || connectionMap[sock].stage != stage ) )
+        {
+            scheduleConnection( sock );
+        }
+    }
+
+    if( schedulerTimer != nullptr && ( ! interactiveLane.isEmpty() || ! bulkLane.isEmpty() ) )
+        schedulerTimer->start();
+}
+
+/**
+ * @brief Advances the state machine of a connection by the data it buffered
+ */
+void SingleApplicationPrivate::readConnection( QLocalSocket *sock )
+{
+    auto &info = connectionMap[sock];
+
+    // A rate limited connection is paused until its retry time, see readMessageHeader()
+    if( info.throttledUntil > 0 && info.throttledUntil > monotonicMSecs() )
+        return;
+
+    switch(info.stage){
+    case StageInitHeader:
+        readMessageHeader( sock, StageInitBody );
+        break;
+    case StageInitBody:
+        readInitMessageBody(sock);
+        break;
+    case StageConnectedHeader:
+        readMessageHeader( sock, StageConnectedBody );
+        break;
+    case StageConnectedBody:
+        slotDataAvailable( sock, info.instanceId );
+        break;
+    default:
+        break;
+    };
+}
+
+void SingleApplicationPrivate::readMessageHeader( QLocalSocket *sock, SingleApplicationPrivate::ConnectionStage nextStage )
+{
+    if (!connectionMap.contains( sock )){
+        return;
+    }
+
+    if( sock->bytesAvailable() < ( qint64 )SingleApplicationCore::headerSize() ){
+        return;
+    }
+
+    TraceScope trace( "readMessageHeader" );
+    QElapsedTimer parseTime;
+    parseTime.start();
+
+    // Read the header to know the message length and topic
+    const QByteArray header = sock->read( SingleApplicationCore::headerSize() );
+    SingleApplicationCore::FrameHeader frameHeader;
+    SingleApplicationCore::decodeFrameHeader( header.constData(), static_cast<std::size_t>( header.size() ), frameHeader );
+    ConnectionInfo &info = connectionMap[sock];
+
+    // Over the limit the header is dropped, the sender gets a busy reply
+    // instead of an acknowledgement and does not send the message
+    if( nextStage == StageConnectedBody ){
+        const qint64 retryAfter = admit( true, info.userId );
+        if( retryAfter > 0 ){
+            writeBusy( sock, retryAfter );
+            info.throttledUntil = monotonicMSecs() + retryAfter;
+
+            // QLocalSocket would otherwise keep reading into its unbounded
+            // buffer. Once the buffer holds a byte it stops reading, so the
+            // rest stays in the kernel buffers and a flooding sender blocks.
+            sock->setReadBufferSize( 1 );
+            QTimer::singleShot( static_cast<int>( qMin<qint64>( retryAfter, std::numeric_limits<int>::max() ) ), sock, [this, sock](){
+                sock->setReadBufferSize( 0 );
+                if( schedulerTimer != nullptr )
+                    scheduleConnection( sock );
+                else
+                    readConnection( sock );
+            });
+            return;
+        }
+    }
+
+    info.stage = nextStage;
+    info.msgLen = static_cast<qint64>( frameHeader.length );
+    info.topic = frameHeader.topic;
+    info.flags = frameHeader.flags;
+    trace.setInstanceId( info.instanceId );
+    trace.setBytes( info.msgLen );
+
+    writeAck( sock );
+
+    stats.headerParseTime.record( parseTime.nsecsElapsed() / 1000 );
+}
+
+bool SingleApplicationPrivate::isFrameComplete( QLocalSocket *sock )
+{
+    if (!connectionMap.contains( sock )){
+        return false;
+    }
+
+    ConnectionInfo &info = connectionMap[sock];
+    if( sock->bytesAvailable() < ( qint64 )info.msgLen ){
+        return false;
+    }
+
+    return true;
+}
+
+void SingleApplicationPrivate::readInitMessageBody( QLocalSocket *sock )
+{
+    Q_Q(SingleApplication);
+
+    if( !isFrameComplete( sock ) )
+        return;
+
+    TraceScope trace( "readInitMessageBody" );
+    QElapsedTimer parseTime;
+    parseTime.start();
+
+    // Read the message body
+    const QByteArray msgBytes = sock->readAll();
+    trace.setBytes( msgBytes.size() );
 
-    bool isValid = readStream.status() == QDataStream::Ok &&
-                   QLatin1String(latin1Name) == blockServerName &&
-                   msgChecksum == actualChecksum;
+    SingleApplicationCore::InitMessage init;
+    const bool isValid = SingleApplicationCore::decodeInitMessage( msgBytes.constData(), static_cast<std::size_t>( msgBytes.size() ), init ) &&
+                         QLatin1String( init.serverName.c_str() ) == blockServerName;
 
     if( !isValid ){
         sock->close();
         return;
     }
 
+    const ConnectionType connectionType = static_cast<ConnectionType>( init.connectionType );
+    const quint32 instanceId = init.instanceId;
+    const qint64 pid = init.pid;
+    trace.setInstanceId( instanceId );
+
     ConnectionInfo &info = connectionMap[sock];
     info.instanceId = instanceId;
     info.stage = StageConnectedHeader;
+    info.connectionType = connectionType;
+    info.pid = pid;
+
+    stats.initParseTime.record( parseTime.nsecsElapsed() / 1000 );
+
+    // Standby instances are exempt, the primary role depends on them
+    if( connectionType != StandbyInstance ){
+        const qint64 retryAfter = admit( false, info.userId );
+        if( retryAfter > 0 ){
+            writeBusy( sock, retryAfter );
+            sock->disconnectFromServer();
+            return;
+        }
+    }
+
+    // Diagnostic request: reply with a snapshot and close the connection
+    if( connectionType == IntrospectionRequest ){
+        writeAck( sock );
+        const QByteArray snapshot = introspectionSnapshot();
+        sock->write( QByteArray::fromStdString( SingleApplicationCore::encodeHeader( static_cast<quint64>( snapshot.size() ) ) ) );
+        sock->write( snapshot );
+        sock->disconnectFromServer();
+        return;
+    }
 
     if( connectionType == NewInstance ||
         ( connectionType == SecondaryInstance &&
           options & SingleApplication::Mode::SecondaryNotification ) )
     {
-        Q_EMIT q->instanceStarted();
+        if( ready )
+            Q_EMIT q->instanceStarted();
+        else
+            ++deferredInstanceStarts;
     }
 
     writeAck( sock );
@@ -515,19 +2823,50 @@ void SingleApplicationPrivate::readInitMessageBody( QLocalSocket *sock )
 
 void SingleApplicationPrivate::slotDataAvailable( QLocalSocket *dataSocket, quint32 instanceId )
 {
-    Q_Q(SingleApplication);
+    // Leave the frame unacknowledged, the sender waits until there is room
+    if( ! ready && pendingMessages.size() >= SingleApplication::MaximumQueuedMessages )
+        return;
 
     if ( !isFrameComplete( dataSocket ) )
         return;
 
-    const QByteArray message = dataSocket->readAll();
+    TraceScope trace( "slotDataAvailable" );
+    trace.setInstanceId( instanceId );
+    QElapsedTimer parseTime;
+    parseTime.start();
+
+    ConnectionInfo &info = connectionMap[dataSocket];
+
+    PendingMessage message;
+    message.instanceId = instanceId;
+    message.topic = info.topic;
+    message.flags = info.flags;
+    message.message = dataSocket->readAll();
+    trace.setBytes( message.message.size() );
 
     writeAck( dataSocket );
 
-    ConnectionInfo &info = connectionMap[dataSocket];
     info.stage = StageConnectedHeader;
 
-    Q_EMIT q->receivedMessage( instanceId, message);
+    stats.messagesReceived.fetch_add( 1, std::memory_order_relaxed );
+    stats.bytesReceived.fetch_add( static_cast<quint64>( message.message.size() ), std::memory_order_relaxed );
+    stats.messageParseTime.record( parseTime.nsecsElapsed() / 1000 );
+
+    orderMessage( message );
+}
+
+/**
+ * @brief Delivers a message now or queues it behind the messages waiting
+ */
+void SingleApplicationPrivate::queueMessage( const PendingMessage &message )
+{
+    // Messages queued earlier, such as spooled or handed over ones, go first
+    if( ready && pendingMessages.isEmpty() ){
+        deliverMessage( message );
+    } else {
+        pendingMessages.append( message );
+        slotDeliverPendingMessages();
+    }
 }
 
 void SingleApplicationPrivate::slotClientConnectionClosed( QLocalSocket *closedSocket, quint32 instanceId )
@@ -536,14 +2875,22 @@ void SingleApplicationPrivate::slotClientConnectionClosed( QLocalSocket *closedS
         slotDataAvailable( closedSocket, instanceId  );
 }
 
-void SingleApplicationPrivate::randomSleep()
+/**
+ * @brief Sleeps for a random period
+ * @param maxMsecs - upper bound, `-1` for none
+ */
+void SingleApplicationPrivate::randomSleep( int maxMsecs )
 {
+    TraceScope trace( "randomSleep" );
 #if QT_VERSION >= QT_VERSION_CHECK( 5, 10, 0 )
-    QThread::msleep( QRandomGenerator::global()->bounded( 8u, 18u ));
+    unsigned long msecs = QRandomGenerator::global()->bounded( 8u, 18u );
 #else
     qsrand( QDateTime::currentMSecsSinceEpoch() % std::numeric_limits<uint>::max() );
-    QThread::msleep( qrand() % 11 + 8);
+    unsigned long msecs = qrand() % 11 + 8;
 #endif
+    if( maxMsecs >= 0 )
+        msecs = qMin( msecs, static_cast<unsigned long>( maxMsecs ) );
+    QThread::msleep( msecs );
 }
 
 void SingleApplicationPrivate::addAppData(const QString &data)
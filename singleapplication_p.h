@@ -33,24 +33,208 @@
 #ifndef SINGLEAPPLICATION_P_H
 #define SINGLEAPPLICATION_P_H
 
+#include <atomic>
+#include <QtCore/QHash>
+#include <QtCore/QList>
 #include <QtCore/QMap>
+#include <QtCore/QJsonObject>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QLoggingCategory>
+#include <QtCore/QTimer>
 #include <QtCore/QSharedMemory>
 #include <QtNetwork/QLocalServer>
 #include <QtNetwork/QLocalSocket>
 #include "singleapplication.h"
 
+/**
+ * @brief Slot of a shared value, guarded by the seqlock in `InstancesInfo`
+ */
+struct SharedValue {
+    quint8 keySize; // 0 if the slot is free
+    quint16 valueSize;
+    char key[SingleApplication::MaximumSharedKeySize];
+    char value[SingleApplication::MaximumSharedValueSize];
+};
+
 struct InstancesInfo {
     bool primary;
     quint32 secondary;
     qint64 primaryPid;
     char primaryUser[128];
-    quint16 checksum; // Must be the last field
+    qint64 primaryHeartbeat; // Monotonic clock msecs of the last primary heartbeat
+    qint32 heartbeatTimeout; // Staleness threshold published by the primary, 0 if disabled
+    quint16 checksum; // Covers the fields above
+    std::atomic<quint32> sequence; // Last sequence number taken, updated without the lock
+    std::atomic<quint32> ackLatency[SingleApplication::Histogram::BucketCount]; // Reported by senders, decayed by the primary
+    std::atomic<qint32> ackLatencyP50; // Published by the primary in microseconds, 0 without samples
+    std::atomic<qint32> ackLatencyP99;
+    std::atomic<quint32> valuesGeneration; // Seqlock of the values, odd while a writer holding the lock updates them
+    SharedValue values[SingleApplication::MaximumSharedValues];
+};
+
+static_assert( ATOMIC_INT_LOCK_FREE == 2, "The sequence counter is shared between processes" );
+
+/**
+ * @brief Shared memory staging area of `Mode::CollapseLaunchStorms`
+ */
+struct StagingArea {
+    quint32 magic;
+    quint32 count; // Number of staged items
+    quint32 used; // Bytes of data in use
+    qint64 flusherPid; // Instance that forwards the batch, 0 if none
+    qint64 windowStart; // Monotonic clock msecs the batch was opened
+    char data[60 * 1024]; // Encoded batch items
 };
 
 struct ConnectionInfo {
     qint64 msgLen = 0;
     quint32 instanceId = 0;
     quint8 stage = 0;
+    quint8 connectionType = 0;
+    qint64 pid = 0; // Only sent by standby instances
+    quint16 topic = 0; // Topic of the message being received
+    quint8 flags = 0; // Frame flags of the message being received
+    bool scheduled = false; // Waiting in a lane of the scheduler
+    qint64 userId = -1; // Peer user, only looked up for rate limits per user
+    qint64 throttledUntil = 0; // Monotonic clock msecs until the connection is read again
+};
+
+struct PendingMessage {
+    quint32 instanceId;
+    quint16 topic;
+    quint8 flags;
+    QByteArray message;
+};
+
+Q_DECLARE_LOGGING_CATEGORY(lcSingleApplicationTrace)
+
+/**
+ * @brief Trace events for each protocol stage, logged to the
+ * `singleapplication.trace` category and written as Chrome/Perfetto JSON to the
+ * file set with `SingleApplication::setTraceFile()` or the
+ * `SINGLEAPPLICATION_TRACE_FILE` environment variable
+ */
+class SingleApplicationTrace {
+public:
+    static void configure();
+    static bool setFile( const QString &fileName );
+    static bool isActive() { return active.load( std::memory_order_relaxed ); }
+    static qint64 timestamp();
+    static void complete( const char *name, qint64 start, qint64 instanceId, qint64 bytes );
+
+private:
+    static void updateActive();
+
+    static std::atomic<bool> active;
+};
+
+/**
+ * @brief Records the duration of a stage as a trace event. Costs a single
+ * branch while tracing is inactive.
+ */
+class TraceScope {
+public:
+    explicit TraceScope( const char *name )
+        : name( nullptr ), start( 0 ), instanceId( -1 ), bytes( -1 )
+    {
+        if( SingleApplicationTrace::isActive() ){
+            this->name = name;
+            start = SingleApplicationTrace::timestamp();
+        }
+    }
+    ~TraceScope() { finish(); }
+
+    TraceScope( const TraceScope& ) = delete;
+    TraceScope &operator=( const TraceScope& ) = delete;
+
+    void setInstanceId( qint64 id ) { instanceId = id; }
+    void setBytes( qint64 count ) { bytes = count; }
+
+    void finish()
+    {
+        if( name != nullptr ){
+            SingleApplicationTrace::complete( name, start, instanceId, bytes );
+            name = nullptr;
+        }
+    }
+
+private:
+    const char *name;
+    qint64 start;
+    qint64 instanceId;
+    qint64 bytes;
+};
+
+/**
+ * @brief Lock-free counterpart of `SingleApplication::Histogram`
+ */
+class HistogramCounters {
+public:
+    HistogramCounters();
+
+    void record( qint64 usecs );
+    SingleApplication::Histogram snapshot() const;
+
+private:
+    std::atomic<quint64> buckets[SingleApplication::Histogram::BucketCount];
+    std::atomic<quint64> count;
+    std::atomic<quint64> sum;
+    std::atomic<quint64> max;
+};
+
+/**
+ * @brief Lock-free counterpart of `SingleApplication::Stats`
+ */
+struct StatsCounters {
+    std::atomic<qint64> electionTime{ 0 };
+    std::atomic<qint64> lockWaitTime{ 0 };
+    std::atomic<quint64> connectRetries{ 0 };
+    std::atomic<quint64> messagesReceived{ 0 };
+    std::atomic<quint64> bytesReceived{ 0 };
+    std::atomic<int> connectionCount{ 0 };
+    std::atomic<quint64> busyReplies{ 0 };
+    HistogramCounters headerParseTime;
+    HistogramCounters initParseTime;
+    HistogramCounters messageParseTime;
+    HistogramCounters sendToAckLatency;
+
+    SingleApplication::Stats snapshot() const;
+};
+
+/**
+ * @brief Point in time every blocking step of an operation has to finish by
+ */
+class Deadline {
+public:
+    explicit Deadline( int msecs ) : msecs( msecs ) { timer.start(); }
+
+    bool hasExpired() const { return msecs >= 0 && timer.elapsed() >= msecs; }
+
+    // Milliseconds left, -1 if the operation may block forever
+    int remaining() const { return msecs < 0 ? -1 : static_cast<int>( qMax<qint64>( msecs - timer.elapsed(), 0 ) ); }
+
+private:
+    QElapsedTimer timer;
+    int msecs;
+};
+
+/**
+ * @brief Rate limit refilled by the monotonic clock
+ */
+class TokenBucket {
+public:
+    TokenBucket() : rate( 0 ), burst( 0 ), tokens( 0 ), updated( -1 ) {}
+
+    void configure( double perSecond, int burst );
+    bool isEnabled() const { return rate > 0; }
+    qint64 waitTime( qint64 now ); // Milliseconds until a token is available
+    void take() { tokens -= 1; }
+
+private:
+    double rate; // Tokens per millisecond
+    double burst;
+    double tokens;
+    qint64 updated;
 };
 
 class SingleApplicationPrivate : public QObject {
@@ -60,7 +244,9 @@ public:
         InvalidConnection = 0,
         NewInstance = 1,
         SecondaryInstance = 2,
-        Reconnect = 3
+        Reconnect = 3,
+        StandbyInstance = 4,
+        IntrospectionRequest = 5
     };
     enum ConnectionStage : quint8 {
         StageInitHeader = 0,
@@ -68,6 +254,33 @@ public:
         StageConnectedHeader = 2,
         StageConnectedBody = 3,
     };
+    enum : int {
+        DefaultHeartbeatTimeout = 10000,
+        MinimumHeartbeatInterval = 50,
+        StandbyConnectTimeout = 100,
+        HandoverTimeout = 1000,
+        InconsistentBlockTimeout = 5000,
+        AdaptiveTimeoutFactor = 4,
+        AdaptiveTimeoutFloor = 25,
+        AdaptiveTimeoutCap = 5000,
+        DefaultSpoolTimeToLive = 60000,
+        SharedValueReadAttempts = 1000
+    };
+    enum : quint8 {
+        HandoverMarker = 'H'
+    };
+    enum : quint32 {
+        StagingMagic = 0x53414c53, // "SALS"
+        LaunchStormWindow = 25
+    };
+    enum : int {
+        MaximumReorderedMessages = 256
+    };
+    enum StagingResult {
+        StagingUnavailable, // Send the message directly
+        StagingAppended, // Another instance forwards the message
+        StagingFlush // Forward the batch
+    };
     Q_DECLARE_PUBLIC(SingleApplication)
 
     SingleApplicationPrivate( SingleApplication *q_ptr );
@@ -75,37 +288,147 @@ public:
 
     static QString getUsername();
     void genBlockServerName();
+    static QSharedMemory *createMemoryBlock( const QString &key );
     void initializeMemoryBlock() const;
     void startPrimary();
     void startSecondary();
-    bool connectToPrimary( int msecs, ConnectionType connectionType );
+    void beginConnectToPrimary();
+    void abandonHandshake();
+    bool connectToPrimary( const Deadline &deadline, ConnectionType connectionType );
+    bool writeInitMessage( const Deadline &deadline, ConnectionType connectionType );
+    static bool forwardToPrimary( const QByteArray &message, SingleApplication::Options options, int msecs, const QString &userData );
+    static qint64 forkFromPrimary( SingleApplication::Options options, int msecs, const QString &userData );
+    static QByteArray activationRecord( const QStringList &environmentNames );
+    static bool startZygote( int &argc, char **&argv );
+    void startForkServer();
+    static void stopForkServer();
+    static int findSharedValue( const InstancesInfo *inst, const QByteArray &key );
+    bool writeSharedValue( const QString &key, const QByteArray *value );
+    QByteArray sharedValue( const QString &key, const QByteArray &defaultValue ) const;
+    void setSharedValuesInterval( int msecs );
+    static bool isProcessRunning( qint64 pid );
+    bool isPrimaryRoleVacant( const InstancesInfo *inst ) const;
+    bool claimPrimaryRole( int msecs );
+    bool waitForPrimaryRole( int msecs );
+    void startWatchingPrimaryRole();
+    void drainConnections( QLocalSocket *successor );
+    bool handOverPrimaryRole();
+    void spoolPendingMessages();
+    bool readHandover();
     quint16 blockChecksum() const;
     qint64 primaryPid() const;
     QString primaryUser() const;
+    bool primaryUnresponsive() const;
+    static bool heartbeatExpired( const InstancesInfo *inst );
+    static qint64 monotonicMSecs();
+    void startHeartbeat();
+    void recordAckLatency( qint64 usecs );
+    void publishAckLatency( InstancesInfo *inst );
+    int adaptiveTimeout( int msecs ) const;
+    void setHeartbeatTimeout( int msecs );
+    bool lockMemory();
+    QByteArray introspectionSnapshot();
+    static QJsonObject statsToJson( const SingleApplication::Stats &stats );
+    void setStatsInterval( int msecs );
     bool isFrameComplete(QLocalSocket *sock);
     void readMessageHeader(QLocalSocket *socket, ConnectionStage nextStage);
     void readInitMessageBody(QLocalSocket *socket);
     void writeAck(QLocalSocket *sock);
-    bool writeConfirmedFrame(int msecs, const QByteArray &msg);
-    bool writeConfirmedMessage(int msecs, const QByteArray &msg, SingleApplication::SendMode sendMode = SingleApplication::NonBlocking);
-    static void randomSleep();
+    void writeBusy( QLocalSocket *sock, qint64 retryAfter );
+    void setRateLimit( SingleApplication::RateLimit limit, double perSecond, int burst );
+    qint64 admit( bool message, qint64 userId );
+    static qint64 peerUserId( QLocalSocket *sock );
+    bool writeConfirmedFrame(const Deadline &deadline, const QByteArray &msg);
+    bool writeConfirmedMessage(const Deadline &deadline, const QByteArray &msg, SingleApplication::SendMode sendMode = SingleApplication::NonBlocking, quint16 topic = 0, quint8 flags = 0);
+    bool sendMessage( quint16 topic, quint8 flags, const QByteArray &message, int timeout, SingleApplication::SendMode sendMode );
+    void deliverMessage( const PendingMessage &message );
+    void dispatchMessage( const PendingMessage &message, QList<SingleApplication::Message> &unhandled );
+    void emitReceivedMessages( const QList<SingleApplication::Message> &messages );
+    void setCoalescingWindow( int msecs, const SingleApplication::CoalescingKeyFunction &keyFunction );
+    void setReady( bool ready );
+    void setOrderingWindow( int msecs );
+    quint32 takeSequence();
+    static quint32 messageSequence( const PendingMessage &message );
+    void orderMessage( const PendingMessage &message );
+    void releaseOrderedMessages( bool skipGap );
+    void queueMessage( const PendingMessage &message );
+    void readConnection( QLocalSocket *sock );
+    void setSchedulingBudget( int msecs, qint64 bytes );
+    qintptr nativeDescriptor();
+    void watchDescriptor( qintptr descriptor );
+    bool processEvents( int msecs );
+    static bool timerDue( QTimer *timer );
+    void scheduleConnection( QLocalSocket *sock );
+    StagingResult stageMessage( const Deadline &deadline, const PendingMessage &message, QByteArray &batch );
+    QString spoolFileName() const;
+    bool spoolMessage( const PendingMessage &message );
+    void replaySpool();
+    static void randomSleep( int maxMsecs = -1 );
     void addAppData(const QString &data);
     QStringList appData() const;
 
     SingleApplication *q_ptr;
     QSharedMemory *memory;
     QLocalSocket *socket;
+    bool pendingHandshake; // The socket connected before the election and awaits its initialisation message
     QLocalServer *server;
     quint32 instanceNumber;
     QString blockServerName;
     SingleApplication::Options options;
     QMap<QLocalSocket*, ConnectionInfo> connectionMap;
     QStringList appDataList;
+    QTimer *heartbeatTimer;
+    int heartbeatTimeout;
+    bool standby;
+    bool watchPrimaryRole;
+    bool handoverReceived;
+    QByteArray handoverData;
+    QList<PendingMessage> pendingMessages;
+    bool ready;
+    int deferredInstanceStarts;
+    int spoolTimeToLive;
+    QHash<quint16, SingleApplication::MessageHandler> handlers;
+    QTimer *coalescingTimer;
+    SingleApplication::CoalescingKeyFunction coalescingKey;
+    QList<SingleApplication::Message> coalescingBuffer;
+    QTimer *schedulerTimer;
+    int pollDescriptor; // epoll instance watching the server and its connections
+    quint64 acceptedConnections; // Tells processEvents() whether polling accepted one
+    int schedulingTimeBudget;
+    qint64 schedulingByteBudget;
+    QList<QLocalSocket*> interactiveLane;
+    QList<QLocalSocket*> bulkLane;
+    QTimer *orderingTimer;
+    QList<PendingMessage> reorderBuffer; // Sorted by sequence number
+    quint32 nextSequence;
+    SingleApplication::ConnectionError lastError;
+    int busyRetryAfter;
+    TokenBucket globalConnections;
+    TokenBucket globalMessages;
+    TokenBucket userConnections; // Copied for each user
+    TokenBucket userMessages; // Copied for each user
+    QHash<qint64, TokenBucket> connectionsByUser;
+    QHash<qint64, TokenBucket> messagesByUser;
+    StatsCounters stats;
+    QTimer *statsTimer;
+    QTimer *valuesTimer;
+    quint32 valuesGenerationSeen;
+    QElapsedTimer primarySince;
+    static int zygoteControl; // Connection to the zygote, see startZygote()
 
 public Q_SLOTS:
     void slotConnectionEstablished();
     void slotDataAvailable( QLocalSocket*, quint32 );
     void slotClientConnectionClosed( QLocalSocket*, quint32 );
+    void slotHeartbeat();
+    void slotPrimaryDisconnected();
+    void slotStandbyReadyRead();
+    void slotDeliverPendingMessages();
+    void slotStatsTimeout();
+    void slotCoalescingTimeout();
+    void slotOrderingTimeout();
+    void slotProcessConnections();
+    void slotSharedValuesTimeout();
 };
 
 #endif // SINGLEAPPLICATION_P_H
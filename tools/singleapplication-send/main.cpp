@@ -0,0 +1,358 @@
+// Copyright (c) Itay Grudev 2015 - 2023
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// Permission is not granted to use this software or any of the associated files
+// as sample data for the purposes of building machine learning models.
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Forwards a message to the primary instance of a SingleApplication based
+// application without starting the application or loading Qt.
+
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <string>
+
+#include <pwd.h>
+#include <unistd.h>
+
+#include "singleapplication_core.h"
+
+namespace {
+
+enum ExitCode {
+    Acknowledged = 0,
+    PrimaryUnavailable = 1,
+    NotAcknowledged = 2,
+    PrimaryBusy = 3,
+    UsageError = 64
+};
+
+void printUsage( const char *program )
+{
+    std::cerr <<
+        "Usage: " << program << " [options] [--] [message...]\n"
+        "\n"
+        "Forwards a message to the running primary instance of a SingleApplication\n"
+        "based application. The options must describe the application the same way\n"
+        "it describes itself, so both derive the same server name.\n"
+        "\n"
+        "Options:\n"
+        "  --name <name>          QCoreApplication::applicationName()\n"
+        "                         (default: base name of --path)\n"
+        "  --organization <name>  QCoreApplication::organizationName()\n"
+        "  --domain <domain>      QCoreApplication::organizationDomain()\n"
+        "  --app-version <ver>    QCoreApplication::applicationVersion()\n"
+        "  --path <file>          QCoreApplication::applicationFilePath()\n"
+        "  --user-data <data>     userData passed to the constructor\n"
+        "  --exclude-version      Mode::ExcludeAppVersion\n"
+        "  --exclude-path         Mode::ExcludeAppPath\n"
+        "  --system               Mode::System instead of Mode::User\n"
+        "  --user-name <name>     user name (default: the effective user)\n"
+        "  --server-name <name>   use this server name instead of deriving it\n"
+        "  --print-server-name    print the server name and exit\n"
+        "  --introspect           print a JSON snapshot of the primary instance's\n"
+        "                         connections, queues and counters instead of\n"
+        "                         sending a message\n"
+        "  --topic <id>           send the message on a topic (1-65535)\n"
+        "  --activate             send the remaining arguments, the working\n"
+        "                         directory and startup environment as an\n"
+        "                         activation, see SingleApplication::sendActivation()\n"
+        "  --fork                 ask a primary instance in Mode::ForkServer to fork\n"
+        "                         a new instance for the remaining arguments, which\n"
+        "                         uses this terminal, and print its process id\n"
+        "  --timeout <msecs>      timeout for the whole exchange, -1 waits forever\n"
+        "                         (default: 1000)\n"
+        "  -h, --help             show this help\n"
+        "\n"
+        "The message is the remaining arguments joined by spaces, or standard\n"
+        "input if it is '-'. Without a message the primary instance only receives\n"
+        "the instanceStarted() notification.\n"
+        "\n"
+        "Exit status: 0 if the primary instance acknowledged the message, 1 if no\n"
+        "primary instance could be reached, 2 if it did not acknowledge, 3 if it is\n"
+        "rate limited and asked to retry later, 64 on usage errors. With --fork, 1\n"
+        "if no new instance was forked.\n";
+}
+
+/**
+ * @brief Exit status of an exchange the primary instance did not acknowledge
+ */
+int notAcknowledged( const SingleApplicationCore::Client &client )
+{
+    if( client.retryAfter() < 0 )
+        return NotAcknowledged;
+
+    std::cerr << "The primary instance is busy, retry after " << client.retryAfter() << " ms" << std::endl;
+    return PrimaryBusy;
+}
+
+/**
+ * @brief Mirrors SingleApplicationPrivate::getUsername()
+ */
+std::string currentUserName()
+{
+    const passwd *pw = getpwuid( geteuid() );
+    if( pw != nullptr && pw->pw_name != nullptr && *pw->pw_name != '\0' )
+        return pw->pw_name;
+
+    const char *user = std::getenv( "USER" );
+    return user != nullptr ? user : "";
+}
+
+/**
+ * @brief QCoreApplication::applicationFilePath() is canonical
+ */
+std::string canonicalPath( const std::string &path )
+{
+    char resolved[PATH_MAX];
+    if( realpath( path.c_str(), resolved ) != nullptr )
+        return resolved;
+    return path;
+}
+
+/**
+ * @brief QCoreApplication::applicationName() defaults to QFileInfo::baseName()
+ * of the executable
+ */
+std::string baseName( const std::string &path )
+{
+    const std::size_t slash = path.rfind( '/' );
+    std::string name = slash == std::string::npos ? path : path.substr( slash + 1 );
+    return name.substr( 0, name.find( '.' ) );
+}
+
+/**
+ * @brief Milliseconds left of the overall timeout, -1 for no timeout
+ */
+int remaining( const std::chrono::steady_clock::time_point &start, int timeout )
+{
+    if( timeout < 0 ) return -1;
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::steady_clock::now() - start ).count();
+    return elapsed < timeout ? static_cast<int>( timeout - elapsed ) : 0;
+}
+
+bool parseNumber( const char *value, int &number )
+{
+    char *end = nullptr;
+    errno = 0;
+    const long parsed = std::strtol( value, &end, 10 );
+    if( errno != 0 || end == value || *end != '\0' || parsed < INT_MIN || parsed > INT_MAX )
+        return false;
+    number = static_cast<int>( parsed );
+    return true;
+}
+
+} // namespace
+
+int main( int argc, char *argv[] )
+{
+    SingleApplicationCore::KeyParameters key;
+    key.includeUser = true;
+    std::string userName;
+    bool userNameSet = false;
+    std::string serverName;
+    bool printServerName = false;
+    bool introspect = false;
+    bool activate = false;
+    bool fork = false;
+    SingleApplicationCore::ActivationRecord activation;
+    int timeout = 1000;
+    int topic = 0;
+    std::string message;
+    bool hasMessage = false;
+
+    int i = 1;
+    for( ; i < argc; ++i ){
+        const std::string arg = argv[i];
+
+        if( arg == "--" ){
+            ++i;
+            break;
+        }
+        if( arg == "-h" || arg == "--help" ){
+            printUsage( argv[0] );
+            return Acknowledged;
+        }
+        if( arg == "--exclude-version" ){
+            key.includeVersion = false;
+            continue;
+        }
+        if( arg == "--exclude-path" ){
+            key.includePath = false;
+            continue;
+        }
+        if( arg == "--system" ){
+            key.includeUser = false;
+            continue;
+        }
+        if( arg == "--print-server-name" ){
+            printServerName = true;
+            continue;
+        }
+        if( arg == "--introspect" ){
+            introspect = true;
+            continue;
+        }
+        if( arg == "--activate" ){
+            activate = true;
+            continue;
+        }
+        if( arg == "--fork" ){
+            activate = true;
+            fork = true;
+            continue;
+        }
+        if( arg.size() < 2 || arg.compare( 0, 2, "--" ) != 0 )
+            break;
+
+        // Every remaining option takes a value
+        if( i + 1 >= argc ){
+            std::cerr << argv[0] << ": missing value for " << arg << "\n";
+            return UsageError;
+        }
+        const char *value = argv[++i];
+
+        if( arg == "--name" ){
+            key.applicationName = value;
+        } else if( arg == "--organization" ){
+            key.organizationName = value;
+        } else if( arg == "--domain" ){
+            key.organizationDomain = value;
+        } else if( arg == "--app-version" ){
+            key.applicationVersion = value;
+        } else if( arg == "--path" ){
+            key.applicationFilePath = canonicalPath( value );
+        } else if( arg == "--user-data" ){
+            key.userData += value;
+        } else if( arg == "--user-name" ){
+            userName = value;
+            userNameSet = true;
+        } else if( arg == "--server-name" ){
+            serverName = value;
+        } else if( arg == "--topic" ){
+            if( ! parseNumber( value, topic ) || topic < 1 || topic > 0xffff ){
+                std::cerr << argv[0] << ": invalid topic: " << value << "\n";
+                return UsageError;
+            }
+        } else if( arg == "--timeout" ){
+            if( ! parseNumber( value, timeout ) || timeout < -1 ){
+                std::cerr << argv[0] << ": invalid timeout: " << value << "\n";
+                return UsageError;
+            }
+        } else {
+            std::cerr << argv[0] << ": unknown option: " << arg << "\n";
+            printUsage( argv[0] );
+            return UsageError;
+        }
+    }
+
+    if( activate ){
+        // The record mirrors QCoreApplication::arguments() of a launched instance
+        activation.timestamp = std::chrono::duration_cast<std::chrono::milliseconds>( std::chrono::system_clock::now().time_since_epoch() ).count();
+        char cwd[PATH_MAX];
+        if( getcwd( cwd, sizeof( cwd ) ) != nullptr )
+            activation.workingDirectory = cwd;
+        activation.arguments.push_back( key.applicationFilePath.empty() ? key.applicationName : key.applicationFilePath );
+        for( ; i < argc; ++i )
+            activation.arguments.push_back( argv[i] );
+        for( const std::string &name : SingleApplicationCore::defaultActivationEnvironment() ){
+            const char *value = std::getenv( name.c_str() );
+            if( value != nullptr )
+                activation.environment.emplace_back( name, value );
+        }
+        message = SingleApplicationCore::encodeActivation( activation );
+    } else if( i < argc && std::strcmp( argv[i], "-" ) == 0 && i + 1 == argc ){
+        message.assign( std::istreambuf_iterator<char>( std::cin ), std::istreambuf_iterator<char>() );
+        hasMessage = true;
+    } else {
+        for( ; i < argc; ++i ){
+            if( hasMessage ) message += ' ';
+            message += argv[i];
+            hasMessage = true;
+        }
+    }
+
+    if( serverName.empty() ){
+        if( key.applicationName.empty() && ! key.applicationFilePath.empty() )
+            key.applicationName = baseName( key.applicationFilePath );
+
+        if( key.applicationName.empty() ){
+            std::cerr << argv[0] << ": one of --name, --path or --server-name is required\n";
+            return UsageError;
+        }
+        if( key.includePath && key.applicationFilePath.empty() ){
+            std::cerr << argv[0] << ": --path is required unless --exclude-path is given\n";
+            return UsageError;
+        }
+        if( key.includeUser )
+            key.userName = userNameSet ? userName : currentUserName();
+
+        serverName = SingleApplicationCore::blockServerName( key );
+    }
+
+    if( printServerName ){
+        std::cout << serverName << std::endl;
+        return Acknowledged;
+    }
+
+    if( fork ){
+        const int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+        const std::int64_t pid = SingleApplicationCore::requestFork( serverName, message, fds, timeout );
+        if( pid < 0 )
+            return PrimaryUnavailable;
+        std::cout << pid << std::endl;
+        return Acknowledged;
+    }
+
+    // Same exchange as SingleApplicationPrivate::connectToPrimary() followed
+    // by sendMessage(). Forwarded launches use instance id 0 like a
+    // non-secondary instance does.
+    const auto start = std::chrono::steady_clock::now();
+
+    SingleApplicationCore::Client client;
+    if( ! client.connectToServer( serverName, timeout ) )
+        return PrimaryUnavailable;
+
+    SingleApplicationCore::InitMessage init;
+    init.serverName = serverName;
+    init.connectionType = introspect ? SingleApplicationCore::IntrospectionRequest : SingleApplicationCore::NewInstance;
+    init.instanceId = 0;
+    init.pid = getpid();
+
+    if( ! client.writeInitMessage( init, remaining( start, timeout ) ) )
+        return notAcknowledged( client );
+
+    if( introspect ){
+        std::string snapshot;
+        if( ! client.readFrame( snapshot, remaining( start, timeout ) ) )
+            return NotAcknowledged;
+        std::cout << snapshot << std::endl;
+        return Acknowledged;
+    }
+
+    if( ! message.empty() && ! client.writeConfirmedMessage( message, remaining( start, timeout ), static_cast<std::uint16_t>( topic ), activate ? SingleApplicationCore::FlagActivation : 0 ) )
+        return notAcknowledged( client );
+
+    return Acknowledged;
+}